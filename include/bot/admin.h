@@ -0,0 +1,20 @@
+#ifndef _ADMIN_H
+#define _ADMIN_H
+
+#include <string>
+
+// команда администратора - JSON вида
+//   {"op": "list" | "get" | "put" | "del", "table": ..., "id": ..., "obj": {...}}
+// таблицы: doctors, specialties, clinics, work_shedule; put без id создает
+// объект, с id - меняет только переданные поля. Связи задаются просто id:
+//   doctors: full_name, phone_number, email, photo, desc, spec [id], ws, clinic
+//   specialties: title, dur; clinics: addr, lat, lon; work_shedule: ws
+// {"op": "broadcast", "text": ...} - рассылка всем чатам,
+// {"op": "broadcast_status"} - ее прогресс,
+// {"op": "roster", "clinic": id, "day": время} - записи клиники за день (TSV),
+// {"op": "load", "from": время, "to": время} - записей по специальностям за
+// день и по клиникам за неделю.
+// Ответ - JSON {"ok": true, ...} или {"ok": false, "error": ...}
+std::string admin_command(const std::string& json);
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "bot/chat.h"
 #include "bot/database.h"
+#include "bot/indexes.h"
+#include "bot/pool.h"
+#include "bot/reminders.h"
 #include "bot/tools.h"
 #include <string>
 
@@ -14,8 +17,11 @@ public:
 	void start();
 
 private:
-	rapidjson::Document config;
+	Config config;
+	ThreadPool pool;
 	DB1 db;
+	Indexes indexes;
+	Reminders reminders;
 	Bot bot;
 	TextManager tm;
 };
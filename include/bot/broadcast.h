@@ -0,0 +1,106 @@
+#ifndef _BROADCAST_H
+#define _BROADCAST_H
+
+#include "bot/models.h"
+#include "bot/ratelimit.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <tgbot/tgbot.h>
+
+// рассылка одного текста всем чатам. Чаты снимаются по возрастанию id,
+// курсор - id, до которого включительно все уже обработано, поэтому новые
+// и удаленные чаты его не сбивают. Отправка идет в workers потоках
+// (поток w берет позиции w, w + workers, ...) через общее ведро токенов
+// и ведро на чат; на 429 ждем retry after. Прогресс пишется в файл,
+// после перезапуска рассылка продолжается с курсора
+class Broadcast
+{
+public:
+	struct Settings
+	{
+		size_t workers;
+		double rate; // сообщений в секунду на всех
+		double burst;
+		double chat_rate; // сообщений в секунду в один чат
+		int attempts;
+		time_t checkpoint_every;
+	};
+
+	Broadcast(TgBot::Bot& bot, const std::string& checkpoint_file,
+		const Settings& settings);
+
+	~Broadcast();
+
+	// число чатов в рассылке; 0 - уже идет другая
+	size_t start(const std::string& text);
+
+	// из потока опроса: сохраняет прогресс, завершает закончившуюся рассылку
+	void poll();
+
+	struct Status
+	{
+		bool active;
+		size_t total;
+		size_t done;
+		size_t sent;
+		size_t failed;
+	};
+
+	Status status() const;
+
+	static Broadcast& get_instance();
+
+private:
+	struct Target
+	{
+		id_t chat;
+		int64_t chat_id;
+	};
+
+	// чаты с id из (cursor, last]
+	void launch(const std::string& text, id_t cursor, id_t last);
+
+	void stop();
+
+	void run(size_t shard);
+
+	void deliver(const Target& t);
+
+	void wait_token(int64_t chat_id);
+
+	void mark_done(size_t pos);
+
+	void checkpoint();
+
+	TgBot::Bot& bot;
+	std::string file;
+	Settings settings;
+
+	mutable std::mutex mtx;
+	std::string text;
+	id_t base_cursor; // курсор на момент запуска или восстановления
+	id_t last_chat;
+	std::vector<Target> targets;
+	std::vector<bool> done;
+	size_t low; // targets[0, low) обработаны
+	TokenBucket global;
+	std::unordered_map<int64_t, TokenBucket> chats;
+	time_t saved_at;
+	size_t saved_low;
+
+	size_t shards;
+	std::atomic<bool> active;
+	std::atomic<bool> stopping;
+	std::atomic<size_t> running;
+	std::atomic<size_t> sent;
+	std::atomic<size_t> failed;
+	std::vector<std::thread> threads;
+
+	static Broadcast* instance;
+};
+
+#endif
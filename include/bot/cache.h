@@ -0,0 +1,75 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// LRU-кэш с версией у каждого значения: значение старой версии считается
+// промахом, так что инвалидация - это просто смена версии у источника
+template<typename K, typename V, typename Hash=std::hash<K>>
+class LruCache
+{
+public:
+	LruCache(size_t capacity)
+	:capacity{capacity}
+	{}
+
+	// nullptr - нет или устарело
+	const V* get(const K& key, uint64_t version)
+	{
+		auto itr = items.find(key);
+		if (itr == items.end() || itr->second.version != version)
+			return nullptr;
+
+		order.splice(order.begin(), order, itr->second.pos);
+		return &itr->second.value;
+	}
+
+	const V& put(const K& key, uint64_t version, V value)
+	{
+		auto itr = items.find(key);
+		if (itr != items.end()) {
+			itr->second.version = version;
+			itr->second.value = std::move(value);
+			order.splice(order.begin(), order, itr->second.pos);
+			return itr->second.value;
+		}
+
+		if (items.size() >= capacity && !order.empty()) {
+			items.erase(order.back());
+			order.pop_back();
+		}
+		order.push_front(key);
+		auto& item = items[key];
+		item = {version, std::move(value), order.begin()};
+		return item.value;
+	}
+
+	void clear()
+	{
+		items.clear();
+		order.clear();
+	}
+
+	size_t size() const
+	{
+		return items.size();
+	}
+
+private:
+	struct Item
+	{
+		uint64_t version;
+		V value;
+		typename std::list<K>::iterator pos;
+	};
+
+	size_t capacity;
+	std::list<K> order; // спереди - недавние
+	std::unordered_map<K, Item, Hash> items;
+};
+
+#endif
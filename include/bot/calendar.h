@@ -0,0 +1,80 @@
+#ifndef _CALENDAR_H
+#define _CALENDAR_H
+
+#include <cstdint>
+#include <ctime>
+
+// Гражданский (пролептический григорианский) календарь без libc:
+// без глобального лока таймзоны и без системных вызовов.
+// month здесь 1..12, как у людей, а не как в struct tm.
+
+struct CivilDate
+{
+	int year;
+	unsigned month;
+	unsigned day;
+};
+
+constexpr bool is_leap(int year)
+{
+	return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+constexpr unsigned days_in_month(int year, unsigned month)
+{
+	constexpr unsigned days[12] = {31, 28, 31, 30,
+		31, 30, 31, 31, 30, 31, 30, 31};
+	return month == 2 && is_leap(year) ? 29 : days[month - 1];
+}
+
+// дней от 1970-01-01
+constexpr int64_t days_from_civil(int year, unsigned month, unsigned day)
+{
+	int64_t y = (int64_t)year - (month <= 2);
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+constexpr CivilDate civil_from_days(int64_t days)
+{
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned doe = (unsigned)(days - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	unsigned d = doy - (153 * mp + 2) / 5 + 1;
+	unsigned m = mp < 10 ? mp + 3 : mp - 9;
+	return {(int)(yoe + era * 400 + (m <= 2)), m, d};
+}
+
+// 0 - воскресенье, как tm_wday
+constexpr unsigned weekday_from_days(int64_t days)
+{
+	return (unsigned)(days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6);
+}
+
+static_assert(days_from_civil(1970, 1, 1) == 0);
+static_assert(days_from_civil(2000, 3, 1) == 11017);
+static_assert(civil_from_days(11017).year == 2000);
+static_assert(weekday_from_days(0) == 4);
+
+// смещение локального времени от UTC в момент t, из заранее
+// посчитанной таблицы переходов
+int64_t utc_offset(time_t t);
+
+// поля как у struct tm (tm_year от 1900, tm_mon 0..11), но без localtime
+struct tm local_tm(time_t t);
+
+// обратное к local_tm, выход за границы месяца/дня нормализуется
+time_t local_mktime(int tm_year, int tm_mon, int tm_mday,
+	int hour=0, int min=0, int sec=0);
+
+time_t day_start(time_t t);
+
+time_t add_days(time_t day, int n);
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef _CHAT_H
 #define _CHAT_H
 
+#include "bot/broadcast.h"
+#include "bot/cache.h"
 #include "bot/handlers.h"
+#include "bot/ratelimit.h"
 #include <tgbot/tgbot.h>
 #include <tgbot/types/GenericReply.h>
 #include <tgbot/types/InlineKeyboardButton.h>
@@ -12,16 +15,37 @@
 class Bot: public EventHandler
 {
 public:
-	Bot(const std::string& token);
+	Bot(const std::string& token,
+		const std::unordered_set<int64_t>& admins={},
+		const std::string& broadcast_file="");
 
 	void infinit_polling();
 
 	void finish();
 
+	bool is_admin(int64_t tg_id) const;
+
 private:
 	void clear_queue();
 
+	void send_waitlist_offers();
+
+	void send_reminders();
+
+	void send_schedule_notices();
+
+	void answer_inline_query(TgBot::InlineQuery::Ptr query);
+
 	TgBot::Bot bot;
+	// по свернутому тексту запроса, версия - availability_version()
+	LruCache<std::u32string, std::vector<TgBot::InlineQueryResult::Ptr>>
+		inline_cache;
+	// уведомления о смене расписания уходят не быстрее rate в секунду
+	TokenBucket schedule_bucket;
+	// tg id пользователей, которым доступна команда /admin
+	std::unordered_set<int64_t> admins;
+	// после bot: потоки рассылки отправляют через него
+	Broadcast broadcast;
 	bool finished;
 };
 
@@ -76,7 +100,8 @@ bool generic_handler(const TextManager& tm, const char* config,
 	TgBot::CallbackQuery::Ptr query=nullptr,
 	std::function<bool()> proc_answ=nullptr);
 
+// дни без свободных слотов по (spec, clinic) зачеркнуты
 TgBot::InlineKeyboardMarkup::Ptr make_calendar_keyboard(const TextManager& tm,
-	int year, int month);
+	int year, int month, id_t spec=0, id_t clinic=0);
 
 #endif
\ No newline at end of file
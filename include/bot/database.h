@@ -25,6 +25,15 @@ public:
 	Table<Speciality> specialties;
 	Table<Clinic> clinics;
 	Table<WorkSchedule> work_shedule;
+	Table<WaitlistEntry> waitlist;
+	Table<PendingNotice> notices;
+
+	using DayKey = std::pair<int64_t, int64_t>;
+
+	// записей по (специальность, день)
+	View<Appointment, DayKey, PairHash> spec_day_load;
+	// записей по (клиника, начало недели)
+	View<Appointment, DayKey, PairHash> clinic_week_load;
 
 	static DB1& get_instance();
 
@@ -26,4 +26,13 @@ private:
 		TgBot::CallbackQuery::Ptr query=nullptr);
 };
 
+// ответ на предложение слота из листа ожидания, приходит в любом
+// состоянии чата; true - чат переведен к подтверждению записи
+bool hdl_waitlist_offer(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::CallbackQuery::Ptr query);
+
+// дорисовывает соседние страницы каруселей, показанных с прошлого вызова;
+// вызывается из потока опроса между запросами обновлений
+void prerender_pending();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,333 @@
+#ifndef _INDEXES_H
+#define _INDEXES_H
+
+#include "bot/models.h"
+#include "bot/search.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+// (специальность, клиника, день), clinic 0 - все клиники
+struct DayKey
+{
+	id_t spec;
+	id_t clinic;
+	time_t day;
+
+	bool operator==(const DayKey& k) const
+	{
+		return spec == k.spec && clinic == k.clinic && day == k.day;
+	}
+};
+
+struct DayKeyHash
+{
+	size_t operator()(const DayKey& k) const
+	{
+		return std::hash<uint64_t>()(
+			((uint64_t)k.spec << 40) ^ ((uint64_t)k.clinic << 24) ^
+			(uint64_t)(k.day / 3600));
+	}
+};
+
+// свободные слоты по (специальность, клиника, день), clinic 0 - все клиники;
+// пересчитывается только затронутый записью день врача
+class FreeSlotIndex
+{
+public:
+	void rebuild();
+
+	int free_slots(id_t spec, id_t clinic, time_t day) const;
+
+	void on_appointment(const Appointment& appo, int sign);
+
+	// sign = -1 перед сменой расписания врача на день, +1 - после
+	void on_schedule(const Doctor& doc, time_t day, int sign);
+
+private:
+	void add(id_t spec, id_t clinic, time_t day, int n);
+
+	mutable std::mutex mtx;
+	std::unordered_map<DayKey, int, DayKeyHash> counts;
+};
+
+// записи владельца (врача, клиента, дня клиники), отсортированные по
+// времени начала
+template<typename K=id_t, typename Hash=std::hash<K>>
+class TimeIndex
+{
+public:
+	struct Entry
+	{
+		time_t from;
+		time_t to;
+		id_t id;
+
+		bool operator<(const Entry& e) const
+		{
+			return from < e.from || (from == e.from && id < e.id);
+		}
+	};
+
+	void insert(const K& owner, const Period& time, id_t id)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto& own = entries[owner];
+		Entry e {time.from, time.to, id};
+		own.vec.insert(std::upper_bound(own.vec.begin(), own.vec.end(), e), e);
+		own.max_len = std::max(own.max_len, time.to - time.from);
+	}
+
+	void erase(const K& owner, const Period& time, id_t id)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = entries.find(owner);
+		if (itr == entries.end())
+			return;
+
+		auto& vec = itr->second.vec;
+		auto i = std::lower_bound(vec.begin(), vec.end(),
+			Entry{time.from, time.to, id});
+		if (i != vec.end() && i->id == id)
+			vec.erase(i);
+		if (vec.empty())
+			entries.erase(itr);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		entries.clear();
+	}
+
+	// есть ли запись, пересекающаяся с p
+	bool overlaps(const K& owner, const Period& p) const
+	{
+		bool res = false;
+		for_overlap(owner, p, [&res](const Entry&) { res = true; });
+		return res;
+	}
+
+	// f(const Entry&) для записей, пересекающихся с p. Записи могут
+	// пересекаться (у дня клиники - записи разных врачей), поэтому
+	// начинаем с p.from минус самая длинная запись владельца
+	template<typename F>
+	void for_overlap(const K& owner, const Period& p, F f) const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = entries.find(owner);
+		if (itr == entries.end())
+			return;
+
+		const auto& own = itr->second;
+		auto i = std::lower_bound(own.vec.begin(), own.vec.end(),
+			Entry{p.from - own.max_len, 0, 0});
+		for (; i != own.vec.end() && i->from <= p.to; ++i)
+			if (i->to >= p.from)
+				f(*i);
+	}
+
+	// f(const Entry&) для записей с началом в [from, to)
+	template<typename F>
+	void for_range(const K& owner, time_t from, time_t to, F f) const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = entries.find(owner);
+		if (itr == entries.end())
+			return;
+
+		const auto& vec = itr->second.vec;
+		auto i = std::lower_bound(vec.begin(), vec.end(), Entry{from, 0, 0});
+		for (; i != vec.end() && i->from < to; ++i)
+			f(*i);
+	}
+
+	// записей владельца с началом не раньше from
+	size_t count_from(const K& owner, time_t from) const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = entries.find(owner);
+		if (itr == entries.end())
+			return 0;
+
+		const auto& vec = itr->second.vec;
+		return vec.end() -
+			std::lower_bound(vec.begin(), vec.end(), Entry{from, 0, 0});
+	}
+
+	// окно [offset, offset + n) среди записей с началом не раньше from
+	std::vector<Entry> window(const K& owner, time_t from, size_t offset,
+		size_t n) const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = entries.find(owner);
+		if (itr == entries.end())
+			return {};
+
+		const auto& vec = itr->second.vec;
+		size_t first = std::lower_bound(vec.begin(), vec.end(),
+			Entry{from, 0, 0}) - vec.begin() + offset;
+		if (first >= vec.size())
+			return {};
+		return std::vector<Entry>(vec.begin() + first,
+			vec.begin() + std::min(vec.size(), first + n));
+	}
+
+	// f(const Entry&) для всех записей владельца
+	template<typename F>
+	void for_each(const K& owner, F f) const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = entries.find(owner);
+		if (itr == entries.end())
+			return;
+
+		for (const auto& e : itr->second.vec)
+			f(e);
+	}
+
+private:
+	struct Entries
+	{
+		std::vector<Entry> vec;
+		// длина самой длинной записи, не уменьшается до опустошения
+		time_t max_len = 0;
+	};
+
+	mutable std::mutex mtx;
+	std::unordered_map<K, Entries, Hash> entries;
+};
+
+// (клиника, день)
+using ClinicDay = std::pair<int64_t, int64_t>;
+
+// врачи по (специальность, клиника), 0 - любая; id по возрастанию.
+// Списки не меняются на месте: изменение подменяет список целиком, так
+// что снимок из get() можно читать без блокировки сколько угодно
+class DoctorsIndex
+{
+public:
+	using List = std::shared_ptr<const std::vector<id_t>>;
+
+	// добавить или обновить врача; false - специальности и клиника те же
+	bool insert(const Doctor& doc);
+
+	void erase(id_t doc);
+
+	List get(id_t spec, id_t clinic) const;
+
+private:
+	using Key = std::pair<int64_t, int64_t>;
+
+	void erase_locked(id_t doc);
+
+	mutable std::mutex mtx;
+	std::unordered_map<Key, List, PairHash> lists;
+	std::unordered_map<id_t, std::vector<Key>> keys; // где лежит врач
+};
+
+// k-d дерево клиник с координатами; точки лежат на единичной сфере,
+// где длина хорды монотонна по расстоянию по поверхности. Клиники
+// меняются редко, поэтому дерево перестраивается целиком
+class GeoIndex
+{
+public:
+	void rebuild();
+
+	// перестраивает дерево, только если клиника появилась, пропала
+	// или сдвинулась: touch бывает и без смены координат
+	void update(const Clinic& clinic);
+
+	// clinic -> подходит ли клиника
+	using filter_f = std::function<bool(id_t clinic)>;
+
+	// до k ближайших подходящих клиник: (км, клиника), по возрастанию
+	// расстояния; неподходящие отсекаются в самом обходе дерева
+	std::vector<std::pair<double, id_t>> nearest(double lat, double lon,
+		size_t k, filter_f filter=nullptr) const;
+
+private:
+	struct Point
+	{
+		double x[3];
+		id_t id;
+	};
+
+	using Heap = std::vector<std::pair<double, id_t>>; // max-куча по хорде^2
+
+	void build(size_t lo, size_t hi, int depth);
+
+	void search(size_t lo, size_t hi, int depth, const double* q, size_t k,
+		const filter_f& filter, Heap& heap) const;
+
+	mutable std::mutex mtx;
+	std::vector<Point> points; // неявное дерево: корень отрезка - его середина
+	std::unordered_map<id_t, std::pair<double, double>> coords; // lat, lon
+};
+
+// слот, освободившийся после удаления записи
+struct FreedSlot
+{
+	id_t doctor;
+	id_t spec;
+	id_t clinic;
+	Period time;
+};
+
+// заявки листа ожидания по дням их диапазона; id заявок растут, поэтому
+// std::set в корзине дня - это очередь, а поиск первой подходящей
+// заявки - два lookup'а по хешу и begin() множества
+class WaitlistIndex
+{
+public:
+	void insert(const WaitlistEntry& e);
+
+	void erase(const WaitlistEntry& e);
+
+	// первая в очереди заявка на слот, 0 - нет
+	id_t match(id_t spec, id_t clinic, time_t time) const;
+
+	// заявки, последний день которых раньше day
+	std::vector<id_t> expired(time_t day) const;
+
+	void push_freed(const FreedSlot& slot);
+
+	std::vector<FreedSlot> take_freed();
+
+private:
+	mutable std::mutex mtx;
+	std::unordered_map<DayKey, std::set<id_t>, DayKeyHash> queues;
+	// (последний день, заявка)
+	std::set<std::pair<time_t, id_t>> ends;
+	std::vector<FreedSlot> freed;
+};
+
+class Indexes
+{
+public:
+	Indexes();
+
+	FreeSlotIndex free_slots;
+	TimeIndex<> doctor_appointments;
+	TimeIndex<> client_appointments;
+	// записи клиники за день, по времени
+	TimeIndex<ClinicDay, PairHash> clinic_day;
+	WaitlistIndex waitlist;
+	TextIndex specialities;
+	TextIndex doctors;
+	DoctorsIndex doctors_by_spec;
+	GeoIndex clinics_geo;
+	// растёт при любом изменении врачей и специальностей
+	std::atomic<uint64_t> directory_ver {1};
+
+	static Indexes& get_instance();
+
+private:
+	static Indexes* instance;
+};
+
+#endif
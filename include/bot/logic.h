@@ -3,6 +3,8 @@
 
 #include "bot/handlers.h"
 #include "bot/models.h"
+#include <chrono>
+#include <ostream>
 
 void log_user(id_t id);
 
@@ -17,23 +19,146 @@ std::shared_ptr<const Speciality> get_speciality(const std::string& title);
 
 std::shared_ptr<const Speciality> get_speciality(id_t id);
 
+// свободный текст: префикс, регистр, опечатки; unique - лучшее совпадение
+// однозначно и его можно брать без уточнения
+std::vector<std::shared_ptr<const Speciality>> find_specialities(
+	const std::string& text, size_t limit, bool* unique=nullptr);
+
 std::shared_ptr<const Clinic> get_clinic(const std::string& address);
 
 std::shared_ptr<const Clinic> get_clinic(id_t id);
 
+// до k ближайших клиник с координатами, где у врачей spec есть свободные
+// слоты в ближайший месяц начиная с from: (км, клиника)
+std::vector<std::pair<double, id_t>> nearest_clinics(double lat, double lon,
+	size_t k, id_t spec, time_t from);
+
 Chat::Tmp& get_tmp_appo(id_t chat);
 
 std::shared_ptr<const Doctor> get_doctor(id_t id);
 
-std::vector<std::shared_ptr<const Doctor>> get_doctors(id_t spec=0, id_t clinic=0);
+// врача могли удалить, пока у пользователя висит кнопка с ним
+bool has_doctor(id_t id);
+
+// id врачей по возрастанию, без копирования: неизменяемый снимок,
+// изменения врачей его не трогают
+std::shared_ptr<const std::vector<id_t>> get_doctors(id_t spec=0, id_t clinic=0);
+
+// по фамилии, имени или отчеству, как find_specialities
+std::vector<std::shared_ptr<const Doctor>> find_doctors(
+	const std::string& text, size_t limit, bool* unique=nullptr);
+
+// nullptr, если записи уже нет
+std::shared_ptr<const Appointment> get_appointment(id_t id);
+
+// ленивый обход свободных слотов врача не раньше from и по день to:
+// ничего не выделяет, можно остановиться на любом слоте и продолжить
+// новым FreeSlots с position(). Единственное место, где решается, свободен
+// ли слот: записи берутся из индекса врача, удержания - если skip_held
+class FreeSlots
+{
+public:
+	FreeSlots(id_t doctor, id_t speciality, time_t from, time_t to,
+		bool skip_held=true);
+
+	// 0 - слоты кончились
+	time_t next();
+
+	time_t position() const;
+
+	class iterator
+	{
+	public:
+		iterator(FreeSlots* slots=nullptr);
 
-std::vector<time_t> all_available_in_day(id_t doctor,
-	id_t speciality, time_t day);
+		time_t operator*() const;
 
-time_t nearest_available_in_day(id_t doctor, id_t speciality, time_t day);
+		iterator& operator++();
+
+		bool operator!=(const iterator& i) const;
+
+	private:
+		FreeSlots* slots;
+		time_t curr;
+	};
+
+	iterator begin();
+
+	iterator end();
+
+private:
+	bool enter_day();
+
+	id_t doc;
+	std::shared_ptr<const WorkSchedule> ws;
+	time_t dur;
+	time_t from;
+	time_t to;
+	bool skip_held;
+	time_t day;
+	const std::vector<Period>* shift;
+	size_t period;
+	time_t t;
+};
 
 time_t nearest_available(id_t doctor, id_t speciality, time_t from=0, time_t to=0);
 
+struct Availability
+{
+	size_t count(size_t doc, size_t day) const;
+
+	const time_t* begin(size_t doc, size_t day) const;
+
+	const time_t* end(size_t doc, size_t day) const;
+
+	time_t nearest(size_t doc) const;
+
+	std::vector<id_t> doctors;
+	std::vector<time_t> days;
+	std::vector<uint32_t> offsets; // doctors.size() * days.size() + 1
+	std::vector<time_t> slots;
+	bool complete; // false, если не все врачи посчитались за budget
+};
+
+// свободные слоты всех врачей (spec, clinic) по дням из [from, to]
+Availability availability(id_t spec, id_t clinic=0, time_t from=0, time_t to=0,
+	std::chrono::milliseconds budget=std::chrono::milliseconds(0),
+	bool skip_held=true);
+
+struct SlotOffer
+{
+	time_t time;
+	id_t doctor;
+};
+
+// первые k свободных слотов (spec, clinic) у любых врачей, по времени
+std::vector<SlotOffer> earliest_available(id_t spec, id_t clinic=0, size_t k=1,
+	time_t from=0, time_t to=0);
+
+uint64_t availability_version();
+
+// врачи, специальности или расписания поменялись в обход записи
+void availability_changed();
+
+// версия справочника врачей, меняется вместе с врачами и специальностями
+uint64_t directory_version();
+
+struct InlineHit
+{
+	enum class Kind {Speciality, Doctor} kind;
+	id_t id;
+	id_t spec; // для врача - специальность, по которой искали слот
+	bool checked; // false - слот не искали, не уложились в бюджет
+	time_t nearest; // 0 - нет слота или не искали
+};
+
+// специальности и врачи по тексту, с ближайшим слотом, пока не вышел
+// бюджет; состояние чатов не трогает
+std::vector<InlineHit> inline_search(const std::string& text, size_t limit,
+	std::chrono::milliseconds budget);
+
+int free_slots_in_day(id_t spec, id_t clinic, time_t day);
+
 void create_client(const std::string& full_name, const std::string& email,
 	const std::string& phone_num, id_t user);
 
@@ -42,13 +167,84 @@ void make_appointment(id_t client, id_t doctor, id_t speciality,
 
 void cancel_appointment(id_t appointment);
 
-std::vector<std::shared_ptr<const Appointment>> get_client_appointments(
-	id_t client);
+struct AppointmentsPage
+{
+	size_t total;
+	std::vector<std::shared_ptr<const Appointment>> items;
+};
+
+// записи клиента с началом не раньше since по времени, только окно
+// [offset, offset + n); since один на счет и окна, иначе они разойдутся
+AppointmentsPage get_client_appointments(id_t client, size_t offset,
+	size_t n, time_t since);
+
+// записи клиники за день по времени, строками TSV:
+// время, врач, специальность, клиент, телефон; возвращает число строк
+size_t export_roster(id_t clinic, time_t day, std::ostream& out);
 
 bool appointment_exist(id_t doctor, id_t speciality, time_t time);
 
+// проверка и запись под локом врача; слот, удержанный другим чатом, занят
+bool try_book(id_t client, id_t doctor, id_t speciality, time_t time,
+	id_t clinic, id_t chat=0);
+
+bool hold_slot(id_t chat, id_t doctor, id_t speciality, time_t time,
+	time_t ttl);
+
+void release_hold(id_t chat, id_t doctor);
+
+// снимает истекшие удержания, чтобы их слоты вернулись в кэши страниц
+void expire_holds();
+
+// меняется при удержании, снятии и истечении удержаний врача
+uint64_t holds_version(id_t doctor);
+
+// dates - дни (полночи), clinic 0 - любая клиника
+void join_waitlist(id_t chat, id_t speciality, id_t clinic,
+	time_t from, time_t to);
+
+struct WaitlistOffer
+{
+	int64_t chat_id;
+	id_t chat;
+	id_t doctor;
+	id_t spec;
+	time_t time;
+};
+
+// разбирает освободившиеся слоты: первый в очереди получает слот,
+// удержанный за ним на ttl секунд, и покидает лист ожидания
+std::vector<WaitlistOffer> take_waitlist_offers(time_t ttl);
+
+struct ScheduleNotice
+{
+	int64_t chat_id;
+	id_t chat;
+	id_t doctor;
+	id_t spec;
+	id_t clinic;
+	time_t time; // отмененная запись
+	time_t offer; // удержанное для клиента время, 0 - нечего предложить
+};
+
+// заменяет расписание у всех его врачей: будущие записи, пересекающиеся
+// с убранными промежутками, отменяются, клиентам ставятся уведомления;
+// возвращает число отмененных записей
+size_t change_work_schedule(id_t schedule,
+	const std::unordered_map<time_t, WorkShift>& ws);
+
+size_t pending_schedule_notices();
+
+// до n самых ранних уведомлений из базы; ближайшее свободное время у того же врача
+// удерживается за клиентом на ttl секунд
+std::vector<ScheduleNotice> take_schedule_notices(size_t n, time_t ttl);
+
 std::vector<std::shared_ptr<const Speciality>> get_all_specialities();
 
+std::vector<std::shared_ptr<const Chat>> get_all_chats();
+
+std::vector<std::shared_ptr<const Clinic>> get_all_clinics();
+
 
 
 
@@ -64,7 +64,9 @@ enum class MainState {
 			ListAppointments,
 				ConfirmCancel,
 			
-		CmdMainMenu};
+		CmdMainMenu,
+		// номера состояний хранятся в базе, новые - только в конец
+		FindDoctor};
 
 enum class SubState {Base, Ask, ProcAnsw, Invalid};
 
@@ -98,7 +100,17 @@ public:
 		time_t to;
 		enum class DateErr {FromLessThanNow, Nan} date_err;
 		id_t doc;
-		int doc_n;
+		size_t doc_n;
+		struct DocsRank {
+			id_t spec;
+			id_t clinic;
+			time_t from;
+			time_t to;
+			uint64_t ver;
+			bool complete;
+			size_t sorted;
+			std::vector<std::pair<time_t, id_t>> docs; // (nearest, doctor)
+		} docs_rank;
 		time_t day;
 		time_t res;
 
@@ -107,10 +119,10 @@ public:
 		std::string email;
 		std::string phone_num;
 
-		int display_appo;
+		size_t display_appo;
 		id_t canc_id;
 
-		int docs_page;
+		size_t docs_page;
 		bool docs_has_next_page;
 	} tmp;
 };
@@ -253,6 +265,10 @@ public:
 	void resolve_relations() {}
 
 	std::string address;
+	// координаты необязательны, located - заданы ли
+	bool located;
+	double lat;
+	double lon;
 	ForeignKey<Clinic, Appointment> appointments;
 	ForeignKey<Clinic, Doctor> doctors;
 };
@@ -277,6 +293,49 @@ public:
 	std::unordered_map<time_t, WorkShift> ws;
 };
 
+// заявка листа ожидания: клиент ждёт освобождения любого слота
+// специальности в клинике (0 - любая) в диапазоне дней dates
+class WaitlistEntry: public Model
+{
+public:
+	WaitlistEntry(id_t chat, id_t speciality, id_t clinic, Period dates);
+
+	WaitlistEntry(const rapidjson::Value& json);
+
+	rapidjson::Value serialize(
+		rapidjson::MemoryPoolAllocator<>& alloc) const override;
+
+	void deserialize(const rapidjson::Value& obj) override;
+
+	void resolve_relations() {}
+
+	ForeignKey<WaitlistEntry, Chat> chat;
+	ForeignKey<WaitlistEntry, Speciality> speciality;
+	id_t clinic;
+	Period dates;
+};
 
+// уведомление об отменённой из-за смены расписания записи, ещё не отправленное
+class PendingNotice: public Model
+{
+public:
+	PendingNotice(id_t chat, id_t doctor, id_t speciality, id_t clinic,
+		time_t time);
+
+	PendingNotice(const rapidjson::Value& json);
+
+	rapidjson::Value serialize(
+		rapidjson::MemoryPoolAllocator<>& alloc) const override;
+
+	void deserialize(const rapidjson::Value& obj) override;
+
+	void resolve_relations() {}
+
+	id_t chat;
+	id_t doctor;
+	id_t speciality;
+	id_t clinic;
+	time_t time;
+};
 
 #endif
\ No newline at end of file
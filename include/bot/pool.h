@@ -0,0 +1,50 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	ThreadPool(size_t workers=0);
+
+	~ThreadPool();
+
+	template<typename F>
+	auto submit(F func) -> std::future<decltype(func())>
+	{
+		auto task = std::make_shared<std::packaged_task<decltype(func())()>>(
+			std::move(func));
+		auto res = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			tasks.push([task](){ (*task)(); });
+		}
+		cv.notify_one();
+		return res;
+	}
+
+	size_t size() const;
+
+	static ThreadPool& get_instance();
+
+private:
+	void work();
+
+	std::vector<std::thread> threads;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopped;
+
+	static ThreadPool* instance;
+};
+
+#endif
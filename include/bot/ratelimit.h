@@ -0,0 +1,56 @@
+#ifndef _RATELIMIT_H
+#define _RATELIMIT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+// ведро токенов: rate токенов в секунду, не больше burst в запасе
+class TokenBucket
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	TokenBucket(double rate, double burst)
+	:rate{rate}, burst{burst}, tokens{burst}, last{clock::now()}
+	{}
+
+	// сколько из n можно отправить сейчас; столько же токенов списывается
+	size_t take(size_t n, clock::time_point now=clock::now())
+	{
+		refill(now);
+		size_t res = tokens > 0 ? std::min(n, (size_t)tokens) : 0;
+		tokens -= res;
+		return res;
+	}
+
+	// целых токенов в запасе, ничего не списывает
+	size_t available(clock::time_point now=clock::now())
+	{
+		refill(now);
+		return tokens > 0 ? (size_t)tokens : 0;
+	}
+
+	// следующий токен появится не раньше чем через delay
+	void pause(clock::duration delay, clock::time_point now=clock::now())
+	{
+		refill(now);
+		tokens = std::min(tokens, 0.0) -
+			std::chrono::duration<double>(delay).count() * rate;
+	}
+
+private:
+	void refill(clock::time_point now)
+	{
+		std::chrono::duration<double> dt = now - last;
+		last = now;
+		tokens = std::min(burst, tokens + dt.count() * rate);
+	}
+
+	double rate;
+	double burst;
+	double tokens;
+	clock::time_point last;
+};
+
+#endif
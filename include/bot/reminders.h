@@ -0,0 +1,42 @@
+#ifndef _REMINDERS_H
+#define _REMINDERS_H
+
+#include "bot/models.h"
+#include "bot/timer.h"
+#include <array>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// напоминания о записях: за сутки и за 2 часа до приема
+class Reminders
+{
+public:
+	enum class Kind {Tomorrow, Soon};
+
+	struct Notice
+	{
+		id_t appointment;
+		Kind kind;
+	};
+
+	Reminders();
+
+	std::vector<Notice> take_due(time_t now);
+
+	static Reminders& get_instance();
+
+private:
+	void schedule(const Appointment& appo, time_t now);
+
+	void cancel(id_t appointment);
+
+	std::mutex mtx;
+	TimingWheel wheel;
+	// по виду напоминания, 0 - таймера нет
+	std::unordered_map<id_t, std::array<TimingWheel::timer_id, 2>> timers;
+
+	static Reminders* instance;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef _SEARCH_H
+#define _SEARCH_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// UTF-8 -> кодовые точки в нижнем регистре (латиница, кириллица, ё -> е),
+// всё кроме букв и цифр - пробел
+std::u32string fold(const std::string& text);
+
+// расстояние Левенштейна, но не больше max + 1
+size_t edit_distance(const std::u32string& a, const std::u32string& b,
+	size_t max);
+
+struct SearchHit
+{
+	id_t id;
+	// 0 - совпадение, 1 - префикс слова, 2 + d - опечатка на d правок
+	int score;
+};
+
+// поиск по коротким текстам (названиям, ФИО): префиксы слов по
+// отсортированному словарю, опечатки - через триграммный индекс
+class TextIndex
+{
+public:
+	// false - текст не изменился, индекс не тронут
+	bool insert(id_t id, const std::string& text);
+
+	void erase(id_t id);
+
+	// лучшие limit совпадений: по score, затем короче и по алфавиту
+	std::vector<SearchHit> search(const std::string& query, size_t limit) const;
+
+private:
+	struct Word
+	{
+		std::u32string word;
+		id_t id;
+
+		bool operator<(const Word& w) const
+		{
+			return word < w.word || (word == w.word && id < w.id);
+		}
+	};
+
+	struct Doc
+	{
+		std::string source;
+		std::u32string text;
+		std::vector<std::u32string> words;
+	};
+
+	static std::vector<std::u32string> split(const std::u32string& text);
+
+	static std::vector<uint64_t> trigrams(const std::u32string& word);
+
+	int fuzzy_score(const Doc& doc, const std::u32string& query,
+		size_t max) const;
+
+	mutable std::mutex mtx;
+	std::unordered_map<id_t, Doc> docs;
+	std::vector<Word> words; // отсортирован
+	std::unordered_map<uint64_t, std::vector<id_t>> grams; // id отсортированы
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -304,9 +305,11 @@ private:
 						if (id == 0)
 							continue; // можно и return
 						call_getter(id).set_null();
+						Table<To>::get_instance().touch(id);
 					}
 					break;
 				default:
+					// убирается только обратная ссылка, поля объекта те же
 					for (id_t id : to_ids) {
 						if (id == 0)
 							continue;
@@ -376,9 +379,13 @@ public:
 		deserialize(table);
 	}
 
+	using listener_f = std::function<void(const std::shared_ptr<T>& x)>;
+
 	void commit(std::shared_ptr<T> x)
 	{
 		this->operator[](x->id()) = x;
+		for (const auto& f : commit_listeners)
+			f(x);
 	}
 
 	std::shared_ptr<T> get(id_t id)
@@ -391,11 +398,49 @@ public:
 		return this->at(id);
 	}
 
+	bool has(id_t id) const
+	{
+		return this->count(id);
+	}
+
 	void del(id_t id)
 	{
+		if (!this->count(id))
+			return;
+
+		// слушатели видят объект еще живым, со всеми связями
+		auto x = this->at(id);
+		for (const auto& f : del_listeners)
+			f(x);
 		this->erase(id);
 	}
 
+	// объект изменился на месте, например каскад обнулил его связь
+	void touch(id_t id)
+	{
+		if (!this->count(id))
+			return;
+
+		auto x = this->at(id);
+		for (const auto& f : update_listeners)
+			f(x);
+	}
+
+	void on_commit(listener_f f)
+	{
+		commit_listeners.push_back(f);
+	}
+
+	void on_update(listener_f f)
+	{
+		update_listeners.push_back(f);
+	}
+
+	void on_del(listener_f f)
+	{
+		del_listeners.push_back(f);
+	}
+
 	size_t size() const
 	{
 		return std::unordered_map<id_t, std::shared_ptr<T>>::size();
@@ -481,10 +526,162 @@ public:
 	}
 
 private:
+	std::vector<listener_f> commit_listeners;
+	std::vector<listener_f> update_listeners;
+	std::vector<listener_f> del_listeners;
+
 	static Table<T>* instance;
 	static bool _is_disabled;
 };
 
+struct PairHash
+{
+	size_t operator()(const std::pair<int64_t, int64_t>& k) const
+	{
+		return std::hash<int64_t>()(k.first * 1000003 ^ k.second);
+	}
+};
+
+inline void push_view_key(rapidjson::Value& arr, int64_t k,
+	rapidjson::MemoryPoolAllocator<>& alloc)
+{
+	arr.PushBack(k, alloc);
+}
+
+inline void push_view_key(rapidjson::Value& arr,
+	const std::pair<int64_t, int64_t>& k,
+	rapidjson::MemoryPoolAllocator<>& alloc)
+{
+	arr.PushBack(k.first, alloc);
+	arr.PushBack(k.second, alloc);
+}
+
+inline void read_view_key(const rapidjson::Value& arr, int64_t& k)
+{
+	k = arr[0].GetInt64();
+}
+
+inline void read_view_key(const rapidjson::Value& arr,
+	std::pair<int64_t, int64_t>& k)
+{
+	k = {arr[0].GetInt64(), arr[1].GetInt64()};
+}
+
+// материализованное представление: сумма value по группам key над
+// таблицей, поддерживается по commit/touch/del без обхода таблицы;
+// пустые группы удаляются, так что groups() - число непустых групп.
+// Слушатели таблицы и читатели могут быть в разных потоках
+template<typename T, typename K, typename Hash=std::hash<K>>
+class View: public Serializable
+{
+public:
+	// false - объект в представление не входит
+	using key_f = std::function<bool(const T& x, K& key)>;
+	// вклад объекта, по умолчанию 1 (количество)
+	using value_f = std::function<int64_t(const T& x)>;
+
+	View(Table<T>& table, key_f key, value_f value=nullptr)
+	:key{key}, value{value}
+	{
+		table.on_commit([this](const auto& x){ update(*x); });
+		table.on_update([this](const auto& x){ update(*x); });
+		table.on_del([this](const auto& x){ remove(x->id()); });
+	}
+
+	int64_t get(const K& k) const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = _groups.find(k);
+		return itr == _groups.end() ? 0 : itr->second;
+	}
+
+	size_t groups() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return _groups.size();
+	}
+
+	// снимок групп
+	std::unordered_map<K, int64_t, Hash> all() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return _groups;
+	}
+
+	// [[ключ..., значение], ...]
+	rapidjson::Value serialize(
+		rapidjson::MemoryPoolAllocator<>& alloc) const override
+	{
+		rapidjson::Value arr(rapidjson::kArrayType);
+		for (const auto& kv : all()) {
+			rapidjson::Value row(rapidjson::kArrayType);
+			push_view_key(row, kv.first, alloc);
+			row.PushBack(kv.second, alloc);
+			arr.PushBack(row, alloc);
+		}
+		return arr;
+	}
+
+	// представление уже собрано при загрузке таблицы, снимок только
+	// сверяется с ним
+	void deserialize(const rapidjson::Value& arr) override
+	{
+		size_t n = 0;
+		for (rapidjson::SizeType i = 0; i < arr.Size(); ++i) {
+			K k;
+			read_view_key(arr[i], k);
+			if (get(k) == arr[i][arr[i].Size() - 1].GetInt64())
+				++n;
+		}
+		if (n != arr.Size() || n != groups())
+			std::cerr << "View: snapshot differs from tables\n";
+	}
+
+private:
+	void update(const T& x)
+	{
+		K k;
+		bool in = key(x, k);
+		int64_t v = in && value ? value(x) : 1;
+
+		std::lock_guard<std::mutex> lock(mtx);
+		remove_locked(x.id());
+		if (!in)
+			return;
+
+		rows[x.id()] = {k, v};
+		add(k, v);
+	}
+
+	void remove(id_t id)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		remove_locked(id);
+	}
+
+	void remove_locked(id_t id)
+	{
+		auto itr = rows.find(id);
+		if (itr == rows.end())
+			return;
+
+		add(itr->second.first, -itr->second.second);
+		rows.erase(itr);
+	}
+
+	void add(const K& k, int64_t v)
+	{
+		if ((_groups[k] += v) == 0)
+			_groups.erase(k);
+	}
+
+	key_f key;
+	value_f value;
+	mutable std::mutex mtx;
+	std::unordered_map<K, int64_t, Hash> _groups;
+	std::unordered_map<id_t, std::pair<K, int64_t>> rows; // вклад объекта
+};
+
 template<typename T>
 Table<T>* Table<T>::instance = nullptr;
 
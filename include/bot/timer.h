@@ -0,0 +1,79 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <unordered_map>
+
+// иерархическое колесо таймеров: 4 уровня по 64 слота, тик tick секунд;
+// таймер лежит на уровне старшей группы бит, в которой его срок
+// расходится с текущим тиком, и спускается ниже, когда колесо доходит
+// до его слота. schedule и cancel - O(1), advance - O(тиков + сработавших)
+class TimingWheel
+{
+public:
+	using timer_id = uint64_t;
+
+	TimingWheel(time_t tick, time_t now);
+
+	timer_id schedule(time_t when, uint64_t data);
+
+	void cancel(timer_id id);
+
+	// f(uint64_t data) для таймеров со сроком <= now
+	template<typename F>
+	void advance(time_t now, F f)
+	{
+		uint64_t target = now / tick;
+		while (cur < target) {
+			++cur;
+			for (int l = levels - 1; l > 0; --l) {
+				if ((cur & ((1ull << (bits * l)) - 1)) == 0)
+					cascade(l);
+			}
+
+			auto& slot = slots[0][cur & mask];
+			while (!slot.empty()) {
+				Node node = slot.front();
+				slot.pop_front();
+				where.erase(node.id);
+				f(node.data);
+			}
+		}
+	}
+
+	size_t size() const;
+
+private:
+	static constexpr int levels = 4;
+	static constexpr int bits = 6;
+	static constexpr uint64_t mask = (1 << bits) - 1;
+
+	struct Node
+	{
+		timer_id id;
+		uint64_t expires;
+		uint64_t data;
+	};
+
+	struct Location
+	{
+		int level;
+		int slot;
+		std::list<Node>::iterator node;
+	};
+
+	void insert(const Node& node);
+
+	void cascade(int level);
+
+	time_t tick;
+	uint64_t cur;
+	timer_id next_id;
+	std::array<std::array<std::list<Node>, 1 << bits>, levels> slots;
+	std::unordered_map<timer_id, Location> where;
+};
+
+#endif
@@ -90,6 +90,25 @@ private:
 	std::unordered_map<States, Handler> handlers;
 };
 
+// значение по цепочке ключей вложенных объектов
+template<typename ...Args>
+const rapidjson::Value& nested_value(const rapidjson::Value& obj,
+	const char* prop, Args ...args)
+{
+	if (!obj.IsObject())
+		throw std::runtime_error(std::string("json: can't extract ") + prop);
+
+	auto itr = obj.FindMember(prop);
+	if (itr == obj.MemberEnd())
+		throw std::runtime_error(std::string("json: can't extract ") + prop);
+
+	if constexpr (sizeof...(args) == 0) {
+		return itr->value;
+	} else {
+		return nested_value(itr->value, args...);
+	}
+}
+
 class TextManager
 {
 public:
@@ -103,14 +122,14 @@ public:
 	template<typename ...Args>
 	const rapidjson::Value& get(Args ...args) const
 	{
-		return get_nested_value(doc[lang_code_to_str()], args...);
+		return nested_value(doc[lang_code_to_str()], args...);
 	}
 
 	template<typename ...Args>
 	bool has(Args ...args) const
 	{
 		try {
-			get_nested_value(doc[lang_code_to_str()], args...);
+			nested_value(doc[lang_code_to_str()], args...);
 		} catch(...) {
 			return false;
 		}
@@ -120,7 +139,7 @@ public:
 	template<typename ...Args>
 	std::string str(Args ...args) const
 	{
-		auto& res = get_nested_value(doc[lang_code_to_str()], args...);
+		auto& res = nested_value(doc[lang_code_to_str()], args...);
 		if (!res.IsString())
 			throw std::runtime_error(
 				"TextManager: received value is not a string");
@@ -136,7 +155,7 @@ public:
 	template<typename ...Args>
 	int num(Args ...args) const
 	{
-		auto& res = get_nested_value(doc[lang_code_to_str()], args...);
+		auto& res = nested_value(doc[lang_code_to_str()], args...);
 		if (!res.IsInt())
 			throw std::runtime_error(
 				"TextManager: received value is not an int");
@@ -146,7 +165,7 @@ public:
 	template<typename ...Args>
 	std::vector<std::string> str_vec(Args ...args) const
 	{
-		auto& res = get_nested_value(doc[lang_code_to_str()], args...);
+		auto& res = nested_value(doc[lang_code_to_str()], args...);
 		if (!res.IsArray())
 			throw std::runtime_error(
 				"TextManager: received value is not an array");
@@ -174,7 +193,7 @@ public:
 	template<typename ...Args>
 	std::vector<int> int_vec(Args ...args) const
 	{
-		auto& res = get_nested_value(doc[lang_code_to_str()], args...);
+		auto& res = nested_value(doc[lang_code_to_str()], args...);
 		if (!res.IsArray())
 			throw std::runtime_error(
 				"TextManager: received value is not an array");
@@ -198,28 +217,68 @@ public:
 	Language lang;
 
 private:
+	const char* lang_code_to_str() const;
+	
+	const rapidjson::Document doc;
+	static TextManager* instance;
+};
+
+// настройки запуска из config.json: файлы, потоки, лимиты и бюджеты;
+// в отличие от текстов от языка не зависят
+class Config
+{
+public:
+	Config(const std::string& file_name);
+
 	template<typename ...Args>
-	const rapidjson::Value& get_nested_value(const rapidjson::Value& obj,
-		const char* prop, Args ...args) const
+	const rapidjson::Value& get(Args ...args) const
 	{
-		if (!obj.IsObject())
-			throw std::runtime_error("TextManager: can't extract the value");
-
-		auto itr = obj.FindMember(prop);
-		if (itr == obj.MemberEnd())
-			throw std::runtime_error("TextManager: can't extract the value");
+		return nested_value(doc, args...);
+	}
 
-		if constexpr (sizeof...(args) == 0) {
-			return itr->value;
-		} else {
-			return get_nested_value(itr->value, args...);
+	template<typename ...Args>
+	bool has(Args ...args) const
+	{
+		try {
+			nested_value(doc, args...);
+		} catch(...) {
+			return false;
 		}
+		return true;
 	}
 
-	const char* lang_code_to_str() const;
-	
+	template<typename ...Args>
+	std::string str(Args ...args) const
+	{
+		auto& res = nested_value(doc, args...);
+		if (!res.IsString())
+			throw std::runtime_error("Config: received value is not a string");
+		return res.GetString();
+	}
+
+	template<typename ...Args>
+	int num(Args ...args) const
+	{
+		auto& res = nested_value(doc, args...);
+		if (!res.IsInt())
+			throw std::runtime_error("Config: received value is not an int");
+		return res.GetInt();
+	}
+
+	template<typename ...Args>
+	double real(Args ...args) const
+	{
+		auto& res = nested_value(doc, args...);
+		if (!res.IsNumber())
+			throw std::runtime_error("Config: received value is not a number");
+		return res.GetDouble();
+	}
+
+	static Config& get_instance();
+
+private:
 	const rapidjson::Document doc;
-	static TextManager* instance;
+	static Config* instance;
 };
 
 template<typename T>
@@ -0,0 +1,459 @@
+#include "bot/admin.h"
+#include "bot/broadcast.h"
+#include "bot/calendar.h"
+#include "bot/database.h"
+#include "bot/indexes.h"
+#include "bot/logic.h"
+#include "bot/models.h"
+#include <algorithm>
+#include <ctime>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+static inline DB1& db()
+{
+	return DB1::get_instance();
+}
+
+static std::string str_field(const rapidjson::Value& obj, const char* key)
+{
+	if (!obj.HasMember(key) || !obj[key].IsString())
+		throw std::runtime_error(std::string("admin: string required: ") + key);
+	return obj[key].GetString();
+}
+
+static id_t id_field(const rapidjson::Value& obj, const char* key)
+{
+	if (!obj.HasMember(key) || !obj[key].IsUint64())
+		throw std::runtime_error(std::string("admin: id required: ") + key);
+	return obj[key].GetUint64();
+}
+
+// нулевая длительность зациклит обход слотов
+static time_t dur_field(const rapidjson::Value& obj)
+{
+	time_t dur = id_field(obj, "dur");
+	if (dur == 0)
+		throw std::runtime_error("admin: dur must be positive");
+	return dur;
+}
+
+template<typename T>
+static void require(id_t id, const char* what)
+{
+	if (!id || !Table<T>::get_instance().has(id))
+		throw std::runtime_error(std::string("admin: no such ") + what +
+			": " + std::to_string(id));
+}
+
+static std::vector<id_t> spec_ids(const rapidjson::Value& obj)
+{
+	if (!obj.HasMember("spec") || !obj["spec"].IsArray())
+		throw std::runtime_error("admin: array required: spec");
+
+	std::vector<id_t> res;
+	const auto& arr = obj["spec"];
+	for (size_t i = 0; i < arr.Size(); ++i) {
+		const auto& v = arr[i];
+		if (!v.IsUint64())
+			throw std::runtime_error("admin: spec must contain ids");
+		require<Speciality>(v.GetUint64(), "speciality");
+		res.push_back(v.GetUint64());
+	}
+	return res;
+}
+
+// свободные слоты врача по всем дням расписания: -1 до изменения, +1 после
+static void recount(const Doctor& doc, int sign)
+{
+	if (doc.work_sch.is_null())
+		return;
+
+	auto& index = Indexes::get_instance().free_slots;
+	for (const auto& kv : doc.work_sch->ws)
+		index.on_schedule(doc, kv.first, sign);
+}
+
+static void recount_spec(const Speciality& spec, int sign)
+{
+	for (id_t doc : spec.doctors)
+		recount(*get_doctor(doc), sign);
+}
+
+static id_t put_doctor(id_t id, const rapidjson::Value& obj)
+{
+	if (!id) {
+		auto specs = spec_ids(obj);
+		id_t ws = obj.HasMember("ws") ? id_field(obj, "ws") : 0;
+		id_t clinic = id_field(obj, "clinic");
+		if (ws)
+			require<WorkSchedule>(ws, "schedule");
+		require<Clinic>(clinic, "clinic");
+
+		auto doc = std::make_shared<Doctor>(str_field(obj, "full_name"),
+			str_field(obj, "phone_number"), str_field(obj, "email"),
+			str_field(obj, "photo"), str_field(obj, "desc"), specs, ws, clinic);
+		doc->specialities.resolve();
+		doc->clinic.resolve();
+		if (ws)
+			doc->work_sch.resolve();
+		db().doctors.commit(doc);
+		recount(*doc, 1);
+		return doc->id();
+	}
+
+	require<Doctor>(id, "doctor");
+	auto doc = db().doctors.get(id);
+	bool relinked = obj.HasMember("spec") || obj.HasMember("ws") ||
+		obj.HasMember("clinic");
+
+	// ссылки проверяются до изменений, чтобы не менять врача наполовину
+	std::vector<id_t> specs;
+	if (obj.HasMember("spec"))
+		specs = spec_ids(obj);
+	id_t ws = obj.HasMember("ws") ? id_field(obj, "ws") : 0;
+	if (ws)
+		require<WorkSchedule>(ws, "schedule");
+	id_t clinic = obj.HasMember("clinic") ? id_field(obj, "clinic") : 0;
+	if (obj.HasMember("clinic"))
+		require<Clinic>(clinic, "clinic");
+
+	if (obj.HasMember("full_name"))
+		doc->full_name = str_field(obj, "full_name");
+	if (obj.HasMember("phone_number"))
+		doc->phone_number = str_field(obj, "phone_number");
+	if (obj.HasMember("email"))
+		doc->email = str_field(obj, "email");
+	if (obj.HasMember("photo"))
+		doc->photo_file = str_field(obj, "photo");
+	if (obj.HasMember("desc"))
+		doc->description = str_field(obj, "desc");
+
+	if (relinked)
+		recount(*doc, -1);
+	if (obj.HasMember("spec")) {
+		std::vector<id_t> old(doc->specialities.begin(), doc->specialities.end());
+		for (id_t s : old) {
+			db().specialties.get(s)->doctors.erase(id);
+			doc->specialities.erase(s);
+			db().specialties.touch(s);
+		}
+		for (id_t s : specs)
+			doc->specialities.insert(s);
+		doc->specialities.resolve();
+		for (id_t s : specs)
+			db().specialties.touch(s);
+	}
+	if (obj.HasMember("ws")) {
+		if (!doc->work_sch.is_null())
+			doc->work_sch->doctors.erase(id);
+		doc->work_sch.set_id(ws, ws != 0);
+	}
+	if (obj.HasMember("clinic")) {
+		doc->clinic->doctors.erase(id);
+		doc->clinic.set_id(clinic, true);
+	}
+	if (relinked)
+		recount(*doc, 1);
+
+	db().doctors.touch(id);
+	return id;
+}
+
+static id_t put_speciality(id_t id, const rapidjson::Value& obj)
+{
+	if (!id) {
+		auto spec = std::make_shared<Speciality>(str_field(obj, "title"),
+			dur_field(obj));
+		db().specialties.commit(spec);
+		return spec->id();
+	}
+
+	require<Speciality>(id, "speciality");
+	auto spec = db().specialties.get(id);
+	if (obj.HasMember("title"))
+		spec->title = str_field(obj, "title");
+	if (obj.HasMember("dur")) {
+		time_t dur = dur_field(obj);
+		// сетка слотов меняется у всех врачей специальности
+		recount_spec(*spec, -1);
+		spec->appointment_duration = dur;
+		recount_spec(*spec, 1);
+	}
+	db().specialties.touch(id);
+	return id;
+}
+
+static void set_location(Clinic& clinic, const rapidjson::Value& obj)
+{
+	if (!obj.HasMember("lat") && !obj.HasMember("lon"))
+		return;
+	if (!obj.HasMember("lat") || !obj["lat"].IsNumber() ||
+			!obj.HasMember("lon") || !obj["lon"].IsNumber())
+		throw std::runtime_error("admin: lat and lon required together");
+
+	clinic.located = true;
+	clinic.lat = obj["lat"].GetDouble();
+	clinic.lon = obj["lon"].GetDouble();
+}
+
+static id_t put_clinic(id_t id, const rapidjson::Value& obj)
+{
+	if (!id) {
+		auto clinic = std::make_shared<Clinic>(str_field(obj, "addr"));
+		set_location(*clinic, obj);
+		db().clinics.commit(clinic);
+		return clinic->id();
+	}
+
+	require<Clinic>(id, "clinic");
+	auto clinic = db().clinics.get(id);
+	if (obj.HasMember("addr"))
+		clinic->address = str_field(obj, "addr");
+	set_location(*clinic, obj);
+	db().clinics.touch(id);
+	return id;
+}
+
+static id_t put_schedule(id_t id, const rapidjson::Value& obj,
+	rapidjson::Value& res, rapidjson::MemoryPoolAllocator<>& alloc)
+{
+	if (!obj.HasMember("ws") || !obj["ws"].IsObject())
+		throw std::runtime_error("admin: object required: ws");
+	auto ws = deserialize_u_map<WorkShift>(obj["ws"]);
+	for (const auto& kv : ws) {
+		if (day_start(kv.first) != kv.first)
+			throw std::runtime_error("admin: ws keys must be local midnights");
+	}
+
+	if (!id) {
+		auto sch = std::make_shared<WorkSchedule>(0,
+			std::unordered_map<time_t, WorkShift>(ws.begin(), ws.end()));
+		db().work_shedule.commit(sch);
+		return sch->id();
+	}
+
+	// существующее расписание меняется только через разбор затронутых записей
+	require<WorkSchedule>(id, "schedule");
+	size_t cancelled = change_work_schedule(id,
+		std::unordered_map<time_t, WorkShift>(ws.begin(), ws.end()));
+	res.AddMember("cancelled", (uint64_t)cancelled, alloc);
+	return id;
+}
+
+static void del(const std::string& table, id_t id)
+{
+	// Restrict в деструкторе связи не должен сработать: проверяем заранее
+	if (table == "doctors") {
+		require<Doctor>(id, "doctor");
+		std::vector<id_t> appos;
+		{
+			auto doc = db().doctors.get(id);
+			time_t now = std::time(0);
+			for (id_t a : doc->appointments) {
+				if (db().appointments.get(a)->time.from >= now)
+					throw std::runtime_error(
+						"admin: doctor has upcoming appointments");
+				appos.push_back(a);
+			}
+		}
+		// прошедшие записи ушли бы каскадом, но уже без живого врача
+		for (id_t a : appos)
+			db().appointments.del(a);
+		recount(*get_doctor(id), -1);
+		db().doctors.del(id);
+	} else if (table == "specialties") {
+		require<Speciality>(id, "speciality");
+		std::vector<id_t> docs;
+		{
+			auto spec = db().specialties.get(id);
+			if (spec->appointments.size())
+				throw std::runtime_error("admin: speciality has appointments");
+			docs.assign(spec->doctors.begin(), spec->doctors.end());
+			recount_spec(*spec, -1);
+		}
+		db().specialties.del(id);
+		for (id_t doc : docs)
+			recount(*get_doctor(doc), 1);
+	} else if (table == "clinics") {
+		require<Clinic>(id, "clinic");
+		{
+			auto clinic = db().clinics.get(id);
+			if (clinic->doctors.size() || clinic->appointments.size())
+				throw std::runtime_error(
+					"admin: clinic has doctors or appointments");
+		}
+		db().clinics.del(id);
+	} else if (table == "work_shedule") {
+		require<WorkSchedule>(id, "schedule");
+		if (db().work_shedule.get(id)->doctors.size())
+			throw std::runtime_error("admin: schedule is used by doctors");
+		db().work_shedule.del(id);
+	} else {
+		throw std::runtime_error("admin: unknown table: " + table);
+	}
+}
+
+template<typename T, typename F>
+static void list(const Table<T>& table, F title, rapidjson::Value& res,
+	rapidjson::MemoryPoolAllocator<>& alloc)
+{
+	rapidjson::Value arr(rapidjson::kArrayType);
+	for (const auto& x : table.all()) {
+		rapidjson::Value item(rapidjson::kArrayType);
+		item.PushBack((uint64_t)x->id(), alloc);
+		item.PushBack(rapidjson::Value(title(*x).c_str(), alloc), alloc);
+		arr.PushBack(item, alloc);
+	}
+	res.AddMember("items", arr, alloc);
+}
+
+// [[id, день или неделя, записей], ...] по ключам с временем в [from, to]
+static rapidjson::Value load_rows(
+	const std::unordered_map<DB1::DayKey, int64_t, PairHash>& groups,
+	time_t from, time_t to, rapidjson::MemoryPoolAllocator<>& alloc)
+{
+	std::vector<std::pair<DB1::DayKey, int64_t>> rows;
+	for (const auto& kv : groups)
+		if (kv.first.second >= from && kv.first.second <= to)
+			rows.push_back(kv);
+	std::sort(rows.begin(), rows.end());
+
+	rapidjson::Value arr(rapidjson::kArrayType);
+	for (const auto& r : rows) {
+		rapidjson::Value row(rapidjson::kArrayType);
+		row.PushBack(r.first.first, alloc);
+		row.PushBack(r.first.second, alloc);
+		row.PushBack(r.second, alloc);
+		arr.PushBack(row, alloc);
+	}
+	return arr;
+}
+
+static void run(const rapidjson::Value& cmd, rapidjson::Value& res,
+	rapidjson::MemoryPoolAllocator<>& alloc)
+{
+	std::string op = str_field(cmd, "op");
+	if (op == "broadcast") {
+		size_t n = Broadcast::get_instance().start(str_field(cmd, "text"));
+		if (n == 0)
+			throw std::runtime_error("admin: broadcast is already running");
+		res.AddMember("chats", (uint64_t)n, alloc);
+		return;
+	}
+	if (op == "broadcast_status") {
+		auto st = Broadcast::get_instance().status();
+		res.AddMember("active", st.active, alloc);
+		res.AddMember("total", (uint64_t)st.total, alloc);
+		res.AddMember("done", (uint64_t)st.done, alloc);
+		res.AddMember("sent", (uint64_t)st.sent, alloc);
+		res.AddMember("failed", (uint64_t)st.failed, alloc);
+		return;
+	}
+	if (op == "load") {
+		time_t from = cmd.HasMember("from") && cmd["from"].IsInt64() ?
+			cmd["from"].GetInt64() : 0;
+		time_t to = cmd.HasMember("to") && cmd["to"].IsInt64() ?
+			cmd["to"].GetInt64() : std::numeric_limits<time_t>::max();
+		res.AddMember("spec_day",
+			load_rows(db().spec_day_load.all(), from, to, alloc), alloc);
+		res.AddMember("clinic_week",
+			load_rows(db().clinic_week_load.all(), from, to, alloc), alloc);
+		return;
+	}
+	if (op == "roster") {
+		id_t clinic = id_field(cmd, "clinic");
+		require<Clinic>(clinic, "clinic");
+		if (!cmd.HasMember("day") || !cmd["day"].IsInt64())
+			throw std::runtime_error("admin: time required: day");
+
+		std::ostringstream out;
+		size_t n = export_roster(clinic, cmd["day"].GetInt64(), out);
+		res.AddMember("rows", (uint64_t)n, alloc);
+		res.AddMember("tsv", rapidjson::Value(out.str().c_str(), alloc), alloc);
+		return;
+	}
+
+	std::string table = str_field(cmd, "table");
+	id_t id = cmd.HasMember("id") ? id_field(cmd, "id") : 0;
+
+	if (op == "list") {
+		if (table == "doctors")
+			list(db().doctors, [](const auto& x){ return x.full_name; }, res, alloc);
+		else if (table == "specialties")
+			list(db().specialties, [](const auto& x){ return x.title; }, res, alloc);
+		else if (table == "clinics")
+			list(db().clinics, [](const auto& x){ return x.address; }, res, alloc);
+		else if (table == "work_shedule")
+			list(db().work_shedule, [](const auto& x){
+				return std::to_string(x.ws.size()); }, res, alloc);
+		else
+			throw std::runtime_error("admin: unknown table: " + table);
+	} else if (op == "get") {
+		rapidjson::Value obj;
+		if (table == "doctors") {
+			require<Doctor>(id, "doctor");
+			obj = db().doctors.get(id)->serialize(alloc);
+		} else if (table == "specialties") {
+			require<Speciality>(id, "speciality");
+			obj = db().specialties.get(id)->serialize(alloc);
+		} else if (table == "clinics") {
+			require<Clinic>(id, "clinic");
+			obj = db().clinics.get(id)->serialize(alloc);
+		} else if (table == "work_shedule") {
+			require<WorkSchedule>(id, "schedule");
+			obj = db().work_shedule.get(id)->serialize(alloc);
+		} else {
+			throw std::runtime_error("admin: unknown table: " + table);
+		}
+		res.AddMember("obj", obj, alloc);
+	} else if (op == "put") {
+		if (!cmd.HasMember("obj") || !cmd["obj"].IsObject())
+			throw std::runtime_error("admin: object required: obj");
+		const auto& obj = cmd["obj"];
+		if (table == "doctors")
+			id = put_doctor(id, obj);
+		else if (table == "specialties")
+			id = put_speciality(id, obj);
+		else if (table == "clinics")
+			id = put_clinic(id, obj);
+		else if (table == "work_shedule")
+			id = put_schedule(id, obj, res, alloc);
+		else
+			throw std::runtime_error("admin: unknown table: " + table);
+		res.AddMember("id", (uint64_t)id, alloc);
+		availability_changed();
+	} else if (op == "del") {
+		del(table, id);
+		availability_changed();
+	} else {
+		throw std::runtime_error("admin: unknown op: " + op);
+	}
+}
+
+std::string admin_command(const std::string& json)
+{
+	rapidjson::Document reply(rapidjson::kObjectType);
+	auto& alloc = reply.GetAllocator();
+	try {
+		rapidjson::Document cmd;
+		cmd.Parse(json.c_str());
+		if (cmd.HasParseError() || !cmd.IsObject())
+			throw std::runtime_error("admin: invalid json");
+
+		run(cmd, reply, alloc);
+		reply.AddMember("ok", true, alloc);
+	} catch (const std::exception& e) {
+		reply.SetObject();
+		reply.AddMember("ok", false, alloc);
+		reply.AddMember("error", rapidjson::Value(e.what(), alloc), alloc);
+	}
+
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	reply.Accept(writer);
+	return buffer.GetString();
+}
@@ -1,11 +1,26 @@
 #include "bot/app.h"
 #include "bot/chat.h"
 
+static std::unordered_set<int64_t> read_admins(const Config& config)
+{
+	std::unordered_set<int64_t> res;
+	if (config.has("admins")) {
+		const auto& arr = config.get("admins");
+		for (size_t i = 0; i < arr.Size(); ++i)
+			res.insert(arr[i].GetInt64());
+	}
+	return res;
+}
+
 ChatBotApp::ChatBotApp(const std::string& file_name)
-:config{read_json(file_name)},
-db{config["db_file"].GetString()},
-bot{config["token"].GetString()},
-tm{config["text_storage_file"].GetString()}
+:config{file_name},
+pool{config.has("workers") ? config.get("workers").GetUint() : 0},
+db{config.str("db_file")},
+indexes{},
+reminders{},
+bot{config.str("token"), read_admins(config),
+	config.has("broadcast_file") ? config.str("broadcast_file") : ""},
+tm{config.str("text_storage_file")}
 {}
 
 void ChatBotApp::start()
@@ -20,7 +35,7 @@ void ChatBotApp::start()
 	// 	std::cerr << "Бот приуныл: " << e.what() << "\n";
 	// }
 
-	db.write(config["db_file"].GetString());
+	db.write(config.str("db_file"));
 
 	std::cout << "Bot finished\n";
 }
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include "bot/broadcast.h"
+#include "bot/chat.h"
+#include "bot/logic.h"
+#include "bot/tools.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+// "Too Many Requests: retry after 7" - секунды ожидания, 0 - не 429
+static int retry_after(const char* what)
+{
+	const char* p = std::strstr(what, "retry after ");
+	return p ? std::max(1, std::atoi(p + std::strlen("retry after "))) : 0;
+}
+
+Broadcast::Broadcast(TgBot::Bot& bot, const std::string& checkpoint_file,
+	const Settings& settings)
+:bot{bot}, file{checkpoint_file}, settings{settings}, base_cursor{0},
+last_chat{0}, low{0}, global{settings.rate, settings.burst}, saved_at{0},
+saved_low{0}, shards{0}, active{false}, stopping{false}, running{0}, sent{0}, failed{0}
+{
+	instance = this;
+	if (file.empty() || !std::ifstream(file).good())
+		return;
+
+	// незаконченная рассылка с прошлого запуска
+	try {
+		auto doc = read_json(file);
+		sent = doc["sent"].GetUint64();
+		failed = doc["failed"].GetUint64();
+		launch(doc["text"].GetString(), doc["cursor"].GetUint64(),
+			doc["last"].GetUint64());
+		std::cerr << "broadcast: resumed after chat " << base_cursor << ", "
+			<< targets.size() << " left\n";
+	} catch (const std::exception& e) {
+		std::cerr << "broadcast: can't resume: " << e.what() << "\n";
+	}
+}
+
+Broadcast::~Broadcast()
+{
+	// курсор сохраняется, после перезапуска рассылка продолжится
+	stop();
+	if (active && low < targets.size())
+		checkpoint();
+	else if (active)
+		std::remove(file.c_str());
+}
+
+size_t Broadcast::start(const std::string& text)
+{
+	if (active)
+		return 0;
+	sent = failed = 0;
+	launch(text, 0, std::numeric_limits<id_t>::max());
+	checkpoint();
+	return targets.size();
+}
+
+void Broadcast::launch(const std::string& text, id_t cursor, id_t last)
+{
+	std::vector<Target> snapshot;
+	for (const auto& chat : get_all_chats()) {
+		if (chat->id() > cursor && chat->id() <= last)
+			snapshot.push_back({chat->id(), chat->chat_id});
+	}
+	std::sort(snapshot.begin(), snapshot.end(),
+		[](const auto& t1, const auto& t2) { return t1.chat < t2.chat; });
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		this->text = text;
+		base_cursor = cursor;
+		targets = std::move(snapshot);
+		// чаты, появившиеся после запуска, в рассылку не попадают
+		last_chat = targets.empty() ? cursor : targets.back().chat;
+		done.assign(targets.size(), false);
+		low = saved_low = 0;
+		saved_at = 0;
+		chats.clear();
+	}
+
+	active = true;
+	stopping = false;
+	shards = std::max<size_t>(1, std::min(settings.workers, targets.size()));
+	running = shards;
+	for (size_t w = 0; w < shards; ++w)
+		threads.emplace_back(&Broadcast::run, this, w);
+}
+
+void Broadcast::stop()
+{
+	stopping = true;
+	for (auto& t : threads)
+		t.join();
+	threads.clear();
+}
+
+void Broadcast::poll()
+{
+	if (!active)
+		return;
+
+	if (running == 0) {
+		stop();
+		active = false;
+		std::remove(file.c_str());
+		std::cerr << "broadcast: finished, sent " << sent << ", failed "
+			<< failed << "\n";
+		return;
+	}
+
+	time_t now = std::time(0);
+	if (now - saved_at >= settings.checkpoint_every)
+		checkpoint();
+}
+
+Broadcast::Status Broadcast::status() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return {active, targets.size(), low, sent, failed};
+}
+
+void Broadcast::run(size_t shard)
+{
+	for (size_t i = shard; i < targets.size() && !stopping; i += shards) {
+		deliver(targets[i]);
+		mark_done(i);
+	}
+	--running;
+}
+
+void Broadcast::deliver(const Target& t)
+{
+	for (int attempt = 0; attempt < settings.attempts && !stopping; ++attempt) {
+		wait_token(t.chat_id);
+		try {
+			Message(text).send(bot, t.chat_id);
+			++sent;
+			std::lock_guard<std::mutex> lock(mtx);
+			chats.erase(t.chat_id);
+			return;
+		} catch (const std::exception& e) {
+			int delay = retry_after(e.what());
+			if (delay == 0)
+				break; // заблокировал бота, чат удален и т.п.
+
+			// 429 - лимит всего бота, а не одного чата
+			std::lock_guard<std::mutex> lock(mtx);
+			global.pause(std::chrono::seconds(delay));
+			chats.emplace(t.chat_id, TokenBucket(settings.chat_rate, 1))
+				.first->second.pause(std::chrono::seconds(delay));
+		}
+	}
+	++failed;
+	std::lock_guard<std::mutex> lock(mtx);
+	chats.erase(t.chat_id);
+}
+
+// токен берется сразу из обоих ведер, иначе ждем
+void Broadcast::wait_token(int64_t chat_id)
+{
+	while (!stopping) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			auto now = TokenBucket::clock::now();
+			auto& chat = chats.emplace(chat_id,
+				TokenBucket(settings.chat_rate, 1)).first->second;
+			if (global.available(now) && chat.available(now)) {
+				global.take(1, now);
+				chat.take(1, now);
+				return;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+}
+
+void Broadcast::mark_done(size_t pos)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	done[pos] = true;
+	while (low < done.size() && done[low])
+		++low;
+}
+
+void Broadcast::checkpoint()
+{
+	rapidjson::Document doc;
+	doc.SetObject();
+	auto& alloc = doc.GetAllocator();
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (low == saved_low && saved_at)
+			return;
+		id_t cursor = low ? targets[low - 1].chat : base_cursor;
+		add_prop(doc, alloc, "text", text);
+		add_prop(doc, alloc, "cursor", cursor);
+		add_prop(doc, alloc, "last", last_chat);
+		saved_low = low;
+	}
+	add_prop(doc, alloc, "sent", (uint64_t)sent);
+	add_prop(doc, alloc, "failed", (uint64_t)failed);
+
+	// сначала во временный файл, чтобы не остаться с половиной снимка
+	try {
+		write_json(file + ".tmp", doc);
+		std::rename((file + ".tmp").c_str(), file.c_str());
+	} catch (const std::exception& e) {
+		std::cerr << "broadcast: " << e.what() << "\n";
+	}
+	saved_at = std::time(0);
+}
+
+Broadcast& Broadcast::get_instance()
+{
+	if (instance == nullptr)
+		throw std::runtime_error("Broadcast::get_instance(): no instance");
+	return *instance;
+}
+
+Broadcast* Broadcast::instance = nullptr;
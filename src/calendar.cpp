@@ -0,0 +1,128 @@
+#include "bot/calendar.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+class ZoneTable
+{
+public:
+	// localtime_r зовется только здесь, один раз при первом обращении
+	ZoneTable()
+	{
+		const time_t step = 24*3600;
+		time_t now = std::time(0);
+		time_t from = 0;
+		time_t to = now + 30*365*step;
+
+		int64_t prev = offset_at(from);
+		transitions.push_back({from, prev});
+		for (time_t t = from + step; t <= to; t += step) {
+			int64_t curr = offset_at(t);
+			if (curr == prev)
+				continue;
+
+			time_t lo = t - step, hi = t;
+			while (hi - lo > 1) {
+				time_t mid = lo + (hi - lo) / 2;
+				if (offset_at(mid) == prev)
+					lo = mid;
+				else
+					hi = mid;
+			}
+			transitions.push_back({hi, curr});
+			prev = curr;
+		}
+	}
+
+	int64_t offset(time_t t) const
+	{
+		auto itr = std::upper_bound(transitions.begin(), transitions.end(), t,
+			[](time_t t, const Transition& tr){ return t < tr.since; });
+		if (itr == transitions.begin())
+			return itr->offset;
+		return (itr - 1)->offset;
+	}
+
+private:
+	static int64_t offset_at(time_t t)
+	{
+		struct tm date;
+		localtime_r(&t, &date);
+		return date.tm_gmtoff;
+	}
+
+	struct Transition
+	{
+		time_t since;
+		int64_t offset;
+	};
+
+	std::vector<Transition> transitions;
+};
+
+const ZoneTable& zone()
+{
+	static const ZoneTable table;
+	return table;
+}
+
+int64_t floor_div(int64_t a, int64_t b)
+{
+	return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+}
+
+int64_t utc_offset(time_t t)
+{
+	return zone().offset(t);
+}
+
+struct tm local_tm(time_t t)
+{
+	int64_t off = utc_offset(t);
+	int64_t local = (int64_t)t + off;
+	int64_t days = floor_div(local, 24*3600);
+	int64_t secs = local - days * 24*3600;
+	CivilDate date = civil_from_days(days);
+
+	struct tm res {};
+	res.tm_year = date.year - 1900;
+	res.tm_mon = date.month - 1;
+	res.tm_mday = date.day;
+	res.tm_hour = secs / 3600;
+	res.tm_min = secs / 60 % 60;
+	res.tm_sec = secs % 60;
+	res.tm_wday = weekday_from_days(days);
+	res.tm_yday = days - days_from_civil(date.year, 1, 1);
+	res.tm_gmtoff = off;
+	return res;
+}
+
+time_t local_mktime(int tm_year, int tm_mon, int tm_mday,
+	int hour, int min, int sec)
+{
+	int year = 1900 + tm_year + floor_div(tm_mon, 12);
+	unsigned month = tm_mon - floor_div(tm_mon, 12) * 12 + 1;
+	int64_t days = days_from_civil(year, month, 1) + tm_mday - 1;
+	int64_t local = days * 24*3600 + hour * 3600 + min * 60 + sec;
+
+	// смещение зависит от искомого момента, уточняем его
+	int64_t off = utc_offset(local);
+	off = utc_offset(local - off);
+	return local - off;
+}
+
+time_t day_start(time_t t)
+{
+	struct tm date = local_tm(t);
+	return local_mktime(date.tm_year, date.tm_mon, date.tm_mday);
+}
+
+time_t add_days(time_t day, int n)
+{
+	struct tm date = local_tm(day);
+	return local_mktime(date.tm_year, date.tm_mon, date.tm_mday + n,
+		date.tm_hour, date.tm_min, date.tm_sec);
+}
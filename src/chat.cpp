@@ -1,13 +1,22 @@
 #include "bot/chat.h"
+#include "bot/admin.h"
+#include "bot/calendar.h"
 #include "bot/logic.h"
 #include "bot/models.h"
+#include "bot/reminders.h"
+#include "bot/search.h"
 #include "bot/tools.h"
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <tgbot/tools/StringTools.h>
 #include <tgbot/types/CallbackQuery.h>
 #include <tgbot/types/GenericReply.h>
+#include <tgbot/types/InlineQuery.h>
+#include <tgbot/types/InlineQueryResultArticle.h>
+#include <tgbot/types/InputFile.h>
+#include <tgbot/types/InputTextMessageContent.h>
 #include <tgbot/types/Message.h>
 #include <tgbot/types/ReplyKeyboardMarkup.h>
 #include <vector>
@@ -27,6 +36,32 @@ static void handler_wrapper(Bot& bot, TgBot::Bot& tg_bot,
 		log_user(user->id());
 	}
 
+	// команды администратора не трогают состояние чата
+	if (msg && StringTools::startsWith(msg->text, "/admin") &&
+			bot.is_admin(tg_id)) {
+		std::string reply = admin_command(msg->text.substr(6));
+		try {
+			// длинный ответ (списки, роспись) телеграм сообщением не примет
+			if (reply.size() > 4096) {
+				auto file = std::make_shared<TgBot::InputFile>();
+				file->data = reply;
+				file->mimeType = "application/json";
+				file->fileName = "admin.json";
+				tg_bot.getApi().sendDocument(msg->chat->id, file);
+			} else {
+				tg_bot.getApi().sendMessage(msg->chat->id, reply);
+			}
+		} catch (const std::exception& e) {
+			std::cerr << "admin: " << e.what() << "\n";
+		}
+		return;
+	}
+
+	if (query && StringTools::startsWith(query->data, "wl_")) {
+		if (!hdl_waitlist_offer(user->chat.get(), tg_bot, query))
+			return;
+	}
+
 	if (msg != nullptr) {
 		if (msg->text == "/menu") {
 			set_chat_state(user->chat->id(), MainState::CmdMainMenu);
@@ -44,8 +79,22 @@ static void handler_wrapper(Bot& bot, TgBot::Bot& tg_bot,
 	}
 }
 
-Bot::Bot(const std::string& token)
-:bot{TgBot::Bot(token)}, finished{false}
+static Broadcast::Settings broadcast_settings()
+{
+	const auto& config = Config::get_instance();
+	return {(size_t)config.num("broadcast", "workers"),
+		config.real("broadcast", "rate"), config.real("broadcast", "burst"),
+		config.real("broadcast", "chat_rate"), config.num("broadcast", "attempts"),
+		(time_t)config.num("broadcast", "checkpoint_every")};
+}
+
+Bot::Bot(const std::string& token, const std::unordered_set<int64_t>& admins,
+	const std::string& broadcast_file)
+:bot{TgBot::Bot(token)}, inline_cache{1024},
+schedule_bucket{Config::get_instance().real("schedule", "rate"),
+	Config::get_instance().real("schedule", "burst")},
+admins{admins}, broadcast{bot, broadcast_file, broadcast_settings()},
+finished{false}
 {	
 	TgBot::Bot& bot_ref {bot};
 	bot.getEvents().onCallbackQuery([&bot_ref, this](auto query) {
@@ -60,6 +109,15 @@ Bot::Bot(const std::string& token)
 	bot.getEvents().onAnyMessage([&bot_ref, this](auto msg) {
 		handler_wrapper(*this, bot_ref, msg, nullptr);
 	});	
+
+	bot.getEvents().onInlineQuery([this](auto query) {
+		answer_inline_query(query);
+	});
+}
+
+bool Bot::is_admin(int64_t tg_id) const
+{
+	return admins.count(tg_id);
 }
 
 void Bot::clear_queue()
@@ -82,10 +140,162 @@ void Bot::infinit_polling()
 			std::cerr << "TgBot error: " << e.what() << "\n";
 			clear_queue();
 		}
+		expire_holds();
+		send_waitlist_offers();
+		send_reminders();
+		send_schedule_notices();
+		broadcast.poll();
+		prerender_pending();
 		request_db_save();
 	}
 }
 
+void Bot::send_waitlist_offers()
+{
+	const auto& tm = TextManager::get_instance();
+	int ttl = Config::get_instance().num("holds", "waitlist_ttl");
+	for (const auto& offer : take_waitlist_offers(ttl)) {
+		auto doc = get_doctor(offer.doctor);
+		std::string text = tm("waitlist", "offer") + "\n" +
+			format_appointment(tm, get_speciality(offer.spec)->title,
+				doc->full_name, doc->clinic->address, offer.time, "    ");
+
+		std::string args = " " + std::to_string(offer.doctor) + " " +
+			std::to_string(offer.spec) + " " + std::to_string(offer.time);
+		auto kb = keyboard(KeyboardType::Inline,
+			tm.int_vec("waitlist", "kb_markup"),
+			tm.vec("waitlist", "kb_text"),
+			{"wl_accept" + args, "wl_decline" + args});
+		try {
+			Message(text, nullptr, kb).send(bot, offer.chat_id);
+		} catch (const std::exception& e) {
+			release_hold(offer.chat, offer.doctor);
+			std::cerr << "send_waitlist_offers: " << e.what() << "\n";
+		}
+	}
+}
+
+void Bot::send_reminders()
+{
+	const auto& tm = TextManager::get_instance();
+	for (const auto& notice : Reminders::get_instance().take_due(std::time(0))) {
+		auto appo = get_appointment(notice.appointment);
+		if (appo == nullptr || appo->client.is_null() ||
+				appo->client->user.is_null() || appo->doctor.is_null())
+			continue;
+
+		const char* kind = notice.kind == Reminders::Kind::Tomorrow ?
+			"tomorrow" : "soon";
+		std::string addr = appo->clinic.is_null() ?
+			appo->doctor->clinic->address : appo->clinic->address;
+		std::string text = tm("reminders", kind) + "\n" +
+			format_appointment(tm, appo->speciality->title,
+				appo->doctor->full_name, addr, appo->time.from, "    ");
+		try {
+			Message(text).send(bot, appo->client->user->chat->chat_id);
+		} catch (const std::exception& e) {
+			std::cerr << "send_reminders: " << e.what() << "\n";
+		}
+	}
+}
+
+void Bot::send_schedule_notices()
+{
+	const auto& tm = TextManager::get_instance();
+	size_t n = schedule_bucket.take(pending_schedule_notices());
+	for (const auto& notice : take_schedule_notices(n,
+			Config::get_instance().num("holds", "waitlist_ttl"))) {
+		auto doc = get_doctor(notice.doctor);
+		std::string spec = get_speciality(notice.spec)->title;
+		std::string addr = notice.clinic ?
+			get_clinic(notice.clinic)->address : doc->clinic->address;
+		std::string text = tm("schedule", "cancelled") + "\n" +
+			format_appointment(tm, spec, doc->full_name, addr,
+				notice.time, "    ");
+
+		TgBot::GenericReply::Ptr kb = nullptr;
+		if (notice.offer) {
+			text += "\n" + tm("schedule", "offer") + "\n" +
+				format_appointment(tm, spec, doc->full_name,
+					doc->clinic->address, notice.offer, "    ");
+			std::string args = " " + std::to_string(notice.doctor) + " " +
+				std::to_string(notice.spec) + " " + std::to_string(notice.offer);
+			kb = keyboard(KeyboardType::Inline,
+				tm.int_vec("waitlist", "kb_markup"),
+				tm.vec("waitlist", "kb_text"),
+				{"wl_accept" + args, "wl_decline" + args});
+		}
+		try {
+			Message(text, nullptr, kb).send(bot, notice.chat_id);
+		} catch (const std::exception& e) {
+			if (notice.offer)
+				release_hold(notice.chat, notice.doctor);
+			std::cerr << "send_schedule_notices: " << e.what() << "\n";
+		}
+	}
+}
+
+// запросы приходят на каждое нажатие клавиши, поэтому одинаковый текст
+// при неизменной доступности отдается из кэша без поиска
+void Bot::answer_inline_query(TgBot::InlineQuery::Ptr query)
+{
+	const auto& tm = TextManager::get_instance();
+	const auto& config = Config::get_instance();
+	auto key = fold(query->query);
+	uint64_t ver = availability_version();
+	auto results = inline_cache.get(key, ver);
+	// ответ, где не для всех успели найти слот, не кэшируется ни здесь,
+	// ни в телеграме
+	std::vector<TgBot::InlineQueryResult::Ptr> partial;
+	if (results == nullptr) {
+		std::vector<TgBot::InlineQueryResult::Ptr> articles;
+		auto hits = inline_search(query->query, config.num("inline", "limit"),
+			std::chrono::milliseconds(config.num("inline", "time_budget")));
+		bool complete = true;
+		for (const auto& hit : hits) {
+			auto article = std::make_shared<TgBot::InlineQueryResultArticle>();
+			std::string desc;
+			if (hit.kind == InlineHit::Kind::Speciality) {
+				article->id = "s" + std::to_string(hit.id);
+				article->title = get_speciality(hit.id)->title;
+			} else {
+				auto doc = get_doctor(hit.id);
+				article->id = "d" + std::to_string(hit.id);
+				article->title = doc->full_name;
+				desc = get_speciality(hit.spec)->title + ", " +
+					doc->clinic->address + "\n";
+			}
+			if (!hit.checked)
+				desc += tm("inline", "text_unchecked");
+			else if (hit.nearest)
+				desc += tm("inline", "text_nearest") +
+					time_to_dd_month_hh_mm(tm, hit.nearest);
+			else
+				desc += tm("inline", "text_no_slots");
+			article->description = desc;
+			complete = complete && hit.checked;
+
+			auto content = std::make_shared<TgBot::InputTextMessageContent>();
+			content->messageText = article->title + "\n" + desc;
+			article->inputMessageContent = content;
+			articles.push_back(article);
+		}
+		if (complete) {
+			results = &inline_cache.put(key, ver, std::move(articles));
+		} else {
+			partial = std::move(articles);
+			results = &partial;
+		}
+	}
+
+	try {
+		bot.getApi().answerInlineQuery(query->id, *results,
+			results == &partial ? 0 : config.num("inline", "cache_time"));
+	} catch (const std::exception& e) {
+		std::cerr << "answerInlineQuery: " << e.what() << "\n";
+	}
+}
+
 void Bot::finish()
 {
 	finished = true;
@@ -402,21 +612,20 @@ bool generic_handler(const TextManager& tm, const char* config,
 	}
 }
 
-TgBot::InlineKeyboardMarkup::Ptr make_calendar_keyboard(const TextManager& tm,
-	int year, int month)
+static std::string strike_through(const std::string& text)
 {
-	static const int days_per_mon[12] = {31, 28, 31, 30,
-		31, 30, 31, 31, 30, 31, 30, 31};
-
-	struct tm date {};
-	date.tm_year = year;
-	date.tm_mon = month;
-	date.tm_mday = 1;
-	std::mktime(&date);
-	int left_offset = (date.tm_wday + 6) % 7;	
-	int days = days_per_mon[month];
-	if (year % 4 == 0 && month == 1)
-		++days;
+	std::string res;
+	for (char c : text)
+		res += std::string(1, c) + u8"\u0336";
+	return res;
+}
+
+static TgBot::InlineKeyboardMarkup::Ptr build_calendar_keyboard(
+	const TextManager& tm, int year, int month, id_t spec, id_t clinic)
+{
+	int64_t first = days_from_civil(1900 + year, month + 1, 1);
+	int left_offset = (weekday_from_days(first) + 6) % 7;
+	int days = days_in_month(1900 + year, month + 1);
 
 	int rows = (left_offset + days + 6) / 7;
 	std::vector<int> kb_markup (rows + 2);
@@ -432,9 +641,13 @@ TgBot::InlineKeyboardMarkup::Ptr make_calendar_keyboard(const TextManager& tm,
 		kb_data[i] = "nan";		
 	}
 
-	for (int i = 0; i < days; ++i)
+	for (int i = 0; i < days; ++i) {
 		kb_text[left_offset + i] = kb_data[left_offset + i] =
 			std::to_string(i + 1);
+		if (spec && !free_slots_in_day(spec, clinic,
+				local_mktime(year, month, i + 1)))
+			kb_text[left_offset + i] = strike_through(kb_text[left_offset + i]);
+	}
 
 	int right_offset = 7 - (left_offset + days) % 7;
 	if (right_offset == 7)
@@ -457,4 +670,47 @@ TgBot::InlineKeyboardMarkup::Ptr make_calendar_keyboard(const TextManager& tm,
 	kb_data[len - 3] = "prev";
 
 	return inline_keyboard(kb_markup, kb_text, kb_data);
-}
\ No newline at end of file
+}
+
+struct CalendarKey
+{
+	int year;
+	int month;
+	TextManager::Language lang;
+	id_t spec;
+	id_t clinic;
+
+	bool operator==(const CalendarKey& k) const
+	{
+		return year == k.year && month == k.month && lang == k.lang &&
+			spec == k.spec && clinic == k.clinic;
+	}
+};
+
+struct CalendarKeyHash
+{
+	size_t operator()(const CalendarKey& k) const
+	{
+		return std::hash<uint64_t>()(
+			((uint64_t)k.spec << 40) ^ ((uint64_t)k.clinic << 24) ^
+			((uint64_t)(k.year * 12 + k.month) << 1) ^ (uint64_t)k.lang);
+	}
+};
+
+// готовые клавиатуры общие для всех чатов и не меняются после сборки;
+// без spec зачеркиваний нет и месяц от данных не зависит
+TgBot::InlineKeyboardMarkup::Ptr make_calendar_keyboard(const TextManager& tm,
+	int year, int month, id_t spec, id_t clinic)
+{
+	static std::mutex mtx;
+	static LruCache<CalendarKey, TgBot::InlineKeyboardMarkup::Ptr,
+		CalendarKeyHash> calendars {256};
+
+	CalendarKey key {year, month, tm.lang, spec, clinic};
+	uint64_t ver = spec ? availability_version() : 0;
+	std::lock_guard<std::mutex> lock(mtx);
+	if (auto res = calendars.get(key, ver))
+		return *res;
+	return calendars.put(key, ver,
+		build_calendar_keyboard(tm, year, month, spec, clinic));
+}
@@ -1,7 +1,26 @@
 #include "bot/database.h"
+#include "bot/calendar.h"
 #include <stdexcept>
 
+static time_t week_start(time_t t)
+{
+	time_t day = day_start(t);
+	return add_days(day, -((local_tm(day).tm_wday + 6) % 7));
+}
+
 DB1::DB1(const std::string& file_name)
+:spec_day_load{appointments, [](const Appointment& a, DayKey& k) {
+	if (a.speciality.is_null())
+		return false;
+	k = {a.speciality.id(), day_start(a.time.from)};
+	return true;
+}},
+clinic_week_load{appointments, [](const Appointment& a, DayKey& k) {
+	if (a.clinic.is_null())
+		return false;
+	k = {a.clinic.id(), week_start(a.time.from)};
+	return true;
+}}
 {
 	DB1::instance = this;
 	read(file_name);
@@ -17,6 +36,8 @@ DB1::~DB1()
 	specialties.disable();
 	clinics.disable();
 	work_shedule.disable();
+	waitlist.disable();
+	notices.disable();
 }
 
 rapidjson::Value DB1::serialize(
@@ -31,6 +52,13 @@ rapidjson::Value DB1::serialize(
 	obj.AddMember("specialties", specialties.serialize(alloc), alloc);
 	obj.AddMember("clinics", clinics.serialize(alloc), alloc);
 	obj.AddMember("work_shedule", work_shedule.serialize(alloc), alloc);
+	obj.AddMember("waitlist", waitlist.serialize(alloc), alloc);
+	obj.AddMember("notices", notices.serialize(alloc), alloc);
+
+	rapidjson::Value views(rapidjson::kObjectType);
+	views.AddMember("spec_day", spec_day_load.serialize(alloc), alloc);
+	views.AddMember("clinic_week", clinic_week_load.serialize(alloc), alloc);
+	obj.AddMember("views", views, alloc);
 	return obj;
 }
 
@@ -44,6 +72,20 @@ void DB1::deserialize(const rapidjson::Value& obj)
 	specialties.deserialize(obj["specialties"]);
 	clinics.deserialize(obj["clinics"]);
 	work_shedule.deserialize(obj["work_shedule"]);
+	// старые снимки базы без листа ожидания и уведомлений
+	if (obj.HasMember("waitlist"))
+		waitlist.deserialize(obj["waitlist"]);
+	if (obj.HasMember("notices"))
+		notices.deserialize(obj["notices"]);
+
+	// представления собраны по ходу загрузки таблиц
+	if (obj.HasMember("views")) {
+		const auto& views = obj["views"];
+		if (views.HasMember("spec_day"))
+			spec_day_load.deserialize(views["spec_day"]);
+		if (views.HasMember("clinic_week"))
+			clinic_week_load.deserialize(views["clinic_week"]);
+	}
 
 	resolve_relations();
 }
@@ -65,6 +107,8 @@ void DB1::resolve_relations()
 	specialties.resolve_relations();
 	clinics.resolve_relations();
 	work_shedule.resolve_relations();
+	waitlist.resolve_relations();
+	notices.resolve_relations();
 }
 
 DB1* DB1::instance = nullptr;
\ No newline at end of file
@@ -1,9 +1,20 @@
 #include "bot/handlers.h"
+#include "bot/cache.h"
+#include "bot/calendar.h"
 #include "bot/chat.h"
 #include "bot/logic.h"
 #include "bot/tools.h"
 #include "bot/models.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 #include <tgbot/tools/StringTools.h>
 #include <tgbot/types/InputFile.h>
 
@@ -12,6 +23,11 @@ const TextManager& tm()
 	return TextManager::get_instance();
 }
 
+static const Config& config()
+{
+	return Config::get_instance();
+}
+
 bool hdl_start(const std::shared_ptr<const Chat>& chat,
 	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
 {
@@ -75,42 +91,182 @@ bool hdl_main_menu(const std::shared_ptr<const Chat>& chat,
 	}
 }
 
+// кнопка "Назад" и по две кнопки в ряд
+template<typename T, typename F>
+static TgBot::GenericReply::Ptr list_keyboard(const char* config,
+	const std::vector<T>& items, F title)
+{
+	std::vector<int> kb_markup {1};
+	std::vector<std::string> kb_text {tm()(config, "return_btn_text")};
+	for (size_t i = 0; i < items.size(); ++i) {
+		if (i % 2 == 0)
+			kb_markup.push_back(0);
+		++kb_markup.back();
+		kb_text.push_back(title(items[i]));
+	}
+	return keyboard(KeyboardType::Reply, kb_markup, kb_text);
+}
+
+static TgBot::GenericReply::Ptr specs_keyboard(
+	const std::vector<std::shared_ptr<const Speciality>>& specs)
+{
+	return list_keyboard("select_spec", specs,
+		[](const auto& s){ return s->title; });
+}
+
 bool hdl_PA_select_service(const std::shared_ptr<const Chat>& chat,
 	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
 {
-	return generic_handler(tm(), "select_spec", chat, bot, msg, query,
-	[&](){
+	size_t kb_limit = tm().num("select_spec", "kb_limit");
+	switch (chat->ss) {
+	case SubState::Ask: {
+		auto specs = get_all_specialities();
+		std::sort(specs.begin(), specs.end(), [](const auto& s1, const auto& s2) {
+			return s1->title < s2->title;
+		});
+		if (specs.size() > kb_limit)
+			specs.resize(kb_limit);
+
+		send_message(tm(), "select_spec", chat, bot,
+			tm()("select_spec", "prompt"), nullptr, specs_keyboard(specs));
+		set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
+		return true;
+	}
+	case SubState::ProcAnsw: {
 		if (msg->text == tm()("select_spec", "return_btn_text")) {
 			set_chat_state(chat->id(), MainState::MakeAppointment);
+			remove_reply_keyboard(bot, chat->chat_id);
+			chat->last_msg_id = 0;
+			return false;
+		}
+
+		bool unique = false;
+		auto specs = find_specialities(msg->text, kb_limit, &unique);
+		if (!specs.empty() && !unique) {
+			send_message(tm(), "select_spec", chat, bot,
+				tm()("select_spec", "refine"), nullptr, specs_keyboard(specs));
+			return true;
+		}
+
+		if (specs.empty()) {
+			set_chat_state(chat->id(), chat->ms, SubState::Invalid);
 		} else {
-			auto spec = get_speciality(msg->text);
-			if (spec == nullptr) {
-				set_chat_state(chat->id(), chat->ms, SubState::Invalid);
-			} else {
-				get_tmp_appo(chat->id()).spec = spec->id();
-				set_chat_state(chat->id(),
-					MainState::PASelectClinic, SubState::Ask);
-			}
+			get_tmp_appo(chat->id()).spec = specs[0]->id();
+			set_chat_state(chat->id(),
+				MainState::PASelectClinic, SubState::Ask);
 		}
 		remove_reply_keyboard(bot, chat->chat_id);
 		chat->last_msg_id = 0;
 		return false;
+	}
+	default:
+		return generic_handler(tm(), "select_spec", chat, bot, msg, query);
+	}
+}
+
+// по геопозиции - клиники по расстоянию, только где есть врачи нужной
+// специальности
+static bool select_clinic_by_location(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::Location::Ptr location)
+{
+	const auto& appo = get_tmp_appo(chat->id());
+	size_t kb_limit = tm().num("select_clinic", "kb_limit");
+	// как и при выборе дат, записаться можно с завтрашнего дня
+	time_t from = add_days(day_start(std::time(0)), 1);
+	auto clinics = nearest_clinics(location->latitude, location->longitude,
+		kb_limit, appo.spec, from);
+
+	// у каждой клиники - ближайшая свободная запись ее врачей
+	std::vector<int> kb_markup;
+	std::vector<std::string> kb_text;
+	std::vector<std::string> kb_data;
+	for (const auto& [km, clinic] : clinics) {
+		auto offers = earliest_available(appo.spec, clinic, 1, from);
+		if (offers.empty())
+			continue;
+		char dist[16];
+		std::snprintf(dist, sizeof(dist), "%.1f", km);
+		kb_markup.push_back(1);
+		kb_text.push_back(get_clinic(clinic)->address + ", " + dist + " " +
+			tm()("select_clinic", "text_km") + ", " +
+			tm()("select_clinic", "text_slot") +
+			time_to_dd_month_hh_mm(tm(), offers[0].time));
+		kb_data.push_back(std::to_string(clinic));
+	}
+	if (kb_text.empty())
+		return false;
+
+	kb_markup.push_back(2);
+	kb_text.push_back(tm()("select_clinic", "text_any"));
+	kb_data.push_back("any");
+	kb_text.push_back(tm()("select_clinic", "text_ret"));
+	kb_data.push_back("ret");
+
+	if (chat->last_msg_id) {
+		try {
+			delete_message(bot, chat->chat_id, chat->last_msg_id);
+		} catch (...) {}
+	}
+	chat->last_msg_id = Message(tm()("select_clinic", "text_nearest"), nullptr,
+		keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data))
+		.send(bot, chat->chat_id);
+	return true;
+}
+
+// "все адреса", затем клиники, где есть врачи spec, по две в ряд
+static TgBot::GenericReply::Ptr clinics_keyboard(id_t spec)
+{
+	auto clinics = get_all_clinics();
+	clinics.erase(std::remove_if(clinics.begin(), clinics.end(),
+		[spec](const auto& c) { return get_doctors(spec, c->id())->empty(); }),
+		clinics.end());
+	std::sort(clinics.begin(), clinics.end(), [](const auto& c1, const auto& c2) {
+		return c1->address < c2->address;
 	});
+
+	std::vector<int> kb_markup;
+	std::vector<std::string> kb_text {tm()("select_clinic", "text_any")};
+	std::vector<std::string> kb_data {"any"};
+	for (const auto& c : clinics) {
+		kb_text.push_back(c->address);
+		kb_data.push_back(std::to_string(c->id()));
+	}
+	for (size_t i = 0; i < kb_text.size(); i += 2)
+		kb_markup.push_back(std::min<size_t>(2, kb_text.size() - i));
+	kb_markup.push_back(1);
+	kb_text.push_back(tm()("select_clinic", "text_ret"));
+	kb_data.push_back("ret");
+	return keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data);
 }
 
 bool hdl_PA_select_clinic(const std::shared_ptr<const Chat>& chat,
 	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
 {
-	return generic_handler(tm(), "select_clinic", chat, bot, msg, query,
-	[&](){
-		if (query->data == "ret") {}
-		else if (query->data == "any")
-			get_tmp_appo(chat->id()).clinic = 0;
-		else	
-			get_tmp_appo(chat->id()).clinic = std::stoi(query->data);
+	if (chat->ss == SubState::Ask) {
+		send_message(tm(), "select_clinic", chat, bot,
+			tm()("select_clinic", "prompt"), nullptr,
+			clinics_keyboard(get_tmp_appo(chat->id()).spec));
+		set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
+		return true;
+	}
+	if (chat->ss != SubState::ProcAnsw)
+		return generic_handler(tm(), "select_clinic", chat, bot, msg, query);
 
+	if (msg) {
+		if (msg->location && select_clinic_by_location(chat, bot, msg->location))
+			return true;
+		set_chat_state(chat->id(), chat->ms, SubState::Invalid);
 		return false;
-	});
+	}
+
+	if (query->data == "ret") {
+		set_chat_state(chat->id(), MainState::PASelectService, SubState::Ask);
+		return false;
+	}
+	get_tmp_appo(chat->id()).clinic =
+		query->data == "any" ? 0 : std::stoi(query->data);
+	set_chat_state(chat->id(), MainState::PASelectDates, SubState::Ask);
+	return false;
 }
 
 bool hdl_PA_select_dates(const std::shared_ptr<const Chat>& chat,
@@ -120,15 +276,13 @@ bool hdl_PA_select_dates(const std::shared_ptr<const Chat>& chat,
 	switch (chat->ss) {
 	case SubState::Ask: {
 		if (appo.year == 0) {
-			time_t now = time(0);
-			struct tm* local_time = std::localtime(&now);
-			int year = local_time->tm_year;
-			int month = local_time->tm_mon;	
-			appo.year = year;
-			appo.month = month;
+			struct tm local_time = local_tm(time(0));
+			appo.year = local_time.tm_year;
+			appo.month = local_time.tm_mon;
 		}
 
-		auto kb = make_calendar_keyboard(tm(), appo.year, appo.month);
+		auto kb = make_calendar_keyboard(tm(), appo.year, appo.month,
+			appo.spec, appo.clinic);
 		std::string prompt = tm()("select_dates", "prompt");
 		prompt += appo.from ?
 			tm()("select_dates", "text_to") : tm()("select_dates", "text_from");
@@ -167,11 +321,8 @@ bool hdl_PA_select_dates(const std::shared_ptr<const Chat>& chat,
 			return false;
 		}
 		default: {
-			struct tm date {};
-			date.tm_year = appo.year;
-			date.tm_mon = appo.month;
-			date.tm_mday = std::stoi(query->data);
-			time_t t = std::mktime(&date);
+			time_t t = local_mktime(appo.year, appo.month,
+				std::stoi(query->data));
 			time_t now = time(0);
 			if (appo.from) {
 				appo.to = t;
@@ -220,67 +371,288 @@ bool hdl_PA_select_dates(const std::shared_ptr<const Chat>& chat,
 	}
 }
 
-bool hdl_PA_select_doctor(const std::shared_ptr<const Chat>& chat,
-	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
+// ключи ближайшей записи считаются один раз на врача, дальше только
+// досортировывается префикс до n-го врача
+static const Chat::Tmp::DocsRank& rank_doctors(Chat::Tmp& appo, size_t n)
 {
-	auto& appo = get_tmp_appo(chat->id());
-	switch (chat->ss) {
-	case SubState::Ask: {
-		auto docs = get_doctors(appo.spec, appo.clinic);
-		std::sort(docs.begin(), docs.end(), 
-		[&](const auto& d1, const auto& d2) {
-			return nearest_available(d1->id(), appo.spec, appo.from, appo.to)
-				< nearest_available(d2->id(), appo.spec, appo.from, appo.to);
-		});
+	auto& rank = appo.docs_rank;
+	if (rank.spec != appo.spec || rank.clinic != appo.clinic ||
+		rank.from != appo.from || rank.to != appo.to ||
+		rank.ver != availability_version()) {
+		auto avail = availability(appo.spec, appo.clinic, appo.from, appo.to,
+			std::chrono::milliseconds(config().num("availability", "time_budget")));
+
+		rank.docs.resize(avail.doctors.size());
+		for (size_t i = 0; i < avail.doctors.size(); ++i) {
+			time_t t = avail.nearest(i);
+			rank.docs[i] = {t ? t : std::numeric_limits<time_t>::max(),
+				avail.doctors[i]};
+		}
 
-		std::vector<int> kb_markup;
-		std::vector<std::string> kb_text;
-		std::vector<std::string> kb_data;
+		rank.spec = appo.spec;
+		rank.clinic = appo.clinic;
+		rank.from = appo.from;
+		rank.to = appo.to;
+		// не досчитанное за бюджет пересчитается при следующем показе
+		rank.ver = avail.complete ? availability_version() : 0;
+		rank.complete = avail.complete;
+		rank.sorted = 0;
+	}
 
-		if (docs.size() == 0) {
-			kb_markup = tm().int_vec("select_doc", "kb_markup0");
-			kb_text = tm().vec("select_doc", "kb_text0");
-			kb_data = tm().vec("select_doc", "kb_data0");
-		} else if (docs.size() == 1) {
-			kb_markup = tm().int_vec("select_doc", "kb_markup1");
-			kb_text = tm().vec("select_doc", "kb_text1");
-			kb_data = tm().vec("select_doc", "kb_data1");
-		} else {
-			kb_markup = tm().int_vec("select_doc", "kb_markup");
-			kb_text = tm().vec("select_doc", "kb_text");
-			kb_data = tm().vec("select_doc", "kb_data");
-
-			if (appo.doc_n + 1 == docs.size()) {
-				kb_text[2] = u8"\u200B";
-				kb_data[2] = "nan";
-			} else if (appo.doc_n == 0) {
-				kb_text[1] = u8"\u200B";
-				kb_data[1] = "nan";
+	if (n >= rank.sorted && rank.sorted < rank.docs.size()) {
+		size_t k = std::min(rank.docs.size(), std::max(n + 1, 2 * rank.sorted));
+		std::partial_sort(rank.docs.begin() + rank.sorted,
+			rank.docs.begin() + k, rank.docs.end());
+		rank.sorted = k;
+	}
+
+	return rank;
+}
+
+// страница карусели, отрисованная заранее: клик prev/next по ней сразу
+// превращается в правку сообщения
+struct CarouselPage
+{
+	int64_t n; // номер врача, записи, страницы или день
+	std::string text;
+	TgBot::GenericReply::Ptr kb;
+	id_t item; // что выбрано на странице: врач, запись
+	size_t count; // сколько всего страниц
+	time_t at;
+};
+
+// без клавиатуры - страницы n уже нет: список сократился, пока чат листал
+static bool page_exists(const CarouselPage& page)
+{
+	return page.kb != nullptr;
+}
+
+using render_f = std::function<CarouselPage(int64_t n)>;
+
+// соседи показанной страницы; версия в кэше - данных, из которых они
+// собраны, ctx - параметров сессии, от которых зависит карусель
+struct Prerendered
+{
+	MainState screen;
+	uint64_t ctx;
+	std::vector<CarouselPage> pages;
+};
+
+struct PrerenderJob
+{
+	std::shared_ptr<const Chat> chat;
+	MainState screen;
+	uint64_t ctx;
+	std::vector<int64_t> pages;
+	render_f render;
+	std::function<uint64_t()> version;
+};
+
+static std::mutex prerender_mtx;
+static std::unordered_map<id_t, PrerenderJob> prerender_jobs;
+
+static LruCache<id_t, Prerendered>& prerendered()
+{
+	static LruCache<id_t, Prerendered> cache(config().num("prerender", "chats"));
+	return cache;
+}
+
+static uint64_t ctx_hash(std::initializer_list<uint64_t> args)
+{
+	uint64_t h = (uint64_t)tm().lang;
+	for (uint64_t a : args)
+		h = (h ^ a) * 1099511628211ull;
+	return h;
+}
+
+// в тексте врачей и записей есть имена и адреса из справочника
+static uint64_t appointments_version()
+{
+	return availability_version() + directory_version();
+}
+
+// готовая страница, если сессия и данные не менялись, иначе рисуется сейчас
+static CarouselPage get_page(const std::shared_ptr<const Chat>& chat,
+	uint64_t ctx, uint64_t ver, int64_t n, const render_f& render)
+{
+	{
+		std::lock_guard<std::mutex> lock(prerender_mtx);
+		auto res = prerendered().get(chat->id(), ver);
+		if (res && res->screen == chat->ms && res->ctx == ctx) {
+			time_t ttl = config().num("prerender", "ttl");
+			for (const auto& page : res->pages) {
+				if (page.n == n && std::time(0) - page.at < ttl)
+					return page;
 			}
 		}
+	}
+	return render(n);
+}
 
-		std::string text;
-		if (docs.size()) {
-			text = "(" + std::to_string(appo.doc_n + 1) +
-				"/" + std::to_string(docs.size()) + ")\n\n" +
-			docs[appo.doc_n]->full_name + "\n" +
-			docs[appo.doc_n]->clinic->address + "\n" +
-			tm()("select_doc", "text_nearest_on") +
-			time_to_dd_month_hh_mm(tm(),
-				nearest_available(docs[appo.doc_n]->id(),
-					appo.spec, appo.from, appo.to));
-
-			appo.doc = docs[appo.doc_n]->id();
-		} else {
-			text = tm()("select_doc", "text_no_available");
+// клик prev/next правит сообщение, с которого пришел, остальное -
+// обычный ответ шага
+static void show_page(const char* config, const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::CallbackQuery::Ptr query, const CarouselPage& page)
+{
+	if (query == nullptr || query->message == nullptr) {
+		send_message(tm(), config, chat, bot, page.text, nullptr, page.kb);
+		return;
+	}
+	chat->last_msg_id = Message(page.text, nullptr, page.kb,
+		query->message->messageId).send(bot, chat->chat_id);
+}
+
+// соседи рисуются в потоке опроса после ответа на всю пачку обновлений,
+// пока пользователь читает страницу; от чата остается последнее задание
+static void prerender(const std::shared_ptr<const Chat>& chat, uint64_t ctx,
+	std::vector<int64_t> pages, render_f render,
+	std::function<uint64_t()> version)
+{
+	std::lock_guard<std::mutex> lock(prerender_mtx);
+	prerender_jobs[chat->id()] = {chat, chat->ms, ctx, std::move(pages),
+		std::move(render), version};
+}
+
+void prerender_pending()
+{
+	std::unordered_map<id_t, PrerenderJob> jobs;
+	{
+		std::lock_guard<std::mutex> lock(prerender_mtx);
+		jobs.swap(prerender_jobs);
+	}
+
+	for (auto& [id, job] : jobs) {
+		// чат уже ушел с экрана, на котором ставилось задание
+		if (job.chat->ms != job.screen || job.chat->ss != SubState::ProcAnsw)
+			continue;
+
+		Prerendered res {job.screen, job.ctx, {}};
+		uint64_t ver = job.version();
+		try {
+			for (int64_t n : job.pages) {
+				auto page = job.render(n);
+				if (page_exists(page))
+					res.pages.push_back(std::move(page));
+			}
+		} catch (const std::exception& e) {
+			std::cerr << "prerender: " << e.what() << "\n";
+			continue;
 		}
 
-		auto kb = keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data);
-		send_message(tm(), "select_doc", chat, bot,
-			text, nullptr, kb);
-		set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
-		return true;
+		std::lock_guard<std::mutex> lock(prerender_mtx);
+		prerendered().put(id, ver, std::move(res));
+	}
+}
+
+static CarouselPage render_doctor(const std::shared_ptr<const Chat>& chat,
+	size_t n)
+{
+	auto& appo = get_tmp_appo(chat->id());
+	const auto& rank = rank_doctors(appo, n);
+	const auto& docs = rank.docs;
+	if (docs.size() && n >= docs.size())
+		return {(int64_t)n, "", nullptr, 0, docs.size(), std::time(0)};
+
+	std::vector<int> kb_markup;
+	std::vector<std::string> kb_text;
+	std::vector<std::string> kb_data;
+
+	if (docs.size() == 0) {
+		kb_markup = tm().int_vec("select_doc", "kb_markup0");
+		kb_text = tm().vec("select_doc", "kb_text0");
+		kb_data = tm().vec("select_doc", "kb_data0");
+	} else if (docs.size() == 1) {
+		kb_markup = tm().int_vec("select_doc", "kb_markup1");
+		kb_text = tm().vec("select_doc", "kb_text1");
+		kb_data = tm().vec("select_doc", "kb_data1");
+	} else {
+		kb_markup = tm().int_vec("select_doc", "kb_markup");
+		kb_text = tm().vec("select_doc", "kb_text");
+		kb_data = tm().vec("select_doc", "kb_data");
+
+		if (n + 1 == docs.size()) {
+			kb_text[2] = u8"\u200B";
+			kb_data[2] = "nan";
+		} else if (n == 0) {
+			kb_text[1] = u8"\u200B";
+			kb_data[1] = "nan";
+		}
+	}
+
+	// после сортировки первым идет врач с самой ранней записью
+	bool none_free = docs.empty() || (rank.complete &&
+		docs[0].first == std::numeric_limits<time_t>::max());
+	// предложение из листа ожидания сразу ведет к подтверждению записи,
+	// поэтому встать в лист может только клиент с заполненной анкетой
+	if (none_free && !chat->user->client.is_null()) {
+		kb_markup.insert(kb_markup.end() - 1, 1);
+		kb_text.insert(kb_text.end() - 1, tm()("waitlist", "text_join"));
+		kb_data.insert(kb_data.end() - 1, "wait");
+	}
+
+	std::string text;
+	id_t item = 0;
+	if (docs.size()) {
+		time_t nearest = docs[n].first;
+		auto doc = get_doctor(docs[n].second);
+		text = "(" + std::to_string(n + 1) +
+			"/" + std::to_string(docs.size()) + ")\n\n" +
+		doc->full_name + "\n" +
+		doc->clinic->address;
+		if (nearest != std::numeric_limits<time_t>::max())
+			text += "\n" + tm()("select_doc", "text_nearest_on") +
+				time_to_dd_month_hh_mm(tm(), nearest);
+
+		item = doc->id();
+	} else {
+		text = tm()("select_doc", "text_no_available");
 	}
+
+	auto kb = keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data);
+	return {(int64_t)n, text, kb, item, docs.size(), std::time(0)};
+}
+
+static uint64_t doctors_ctx(const std::shared_ptr<const Chat>& chat,
+	const Chat::Tmp& appo)
+{
+	return ctx_hash({appo.spec, appo.clinic, (uint64_t)appo.from,
+		(uint64_t)appo.to, chat->user->client.is_null()});
+}
+
+static bool show_doctors(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::CallbackQuery::Ptr query)
+{
+	auto& appo = get_tmp_appo(chat->id());
+	render_f render = [chat](int64_t n) { return render_doctor(chat, n); };
+	uint64_t ctx = doctors_ctx(chat, appo);
+	auto page = get_page(chat, ctx, appointments_version(),
+		appo.doc_n, render);
+	if (!page_exists(page)) {
+		appo.doc_n = page.count - 1;
+		page = render(appo.doc_n);
+	}
+	if (page.count)
+		appo.doc = page.item;
+
+	show_page("select_doc", chat, bot, query, page);
+	set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
+
+	std::vector<int64_t> next;
+	if (appo.doc_n > 0)
+		next.push_back(appo.doc_n - 1);
+	if (appo.doc_n + 1 < page.count)
+		next.push_back(appo.doc_n + 1);
+	prerender(chat, ctx, next, render, appointments_version);
+	return true;
+}
+
+bool hdl_PA_select_doctor(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
+{
+	auto& appo = get_tmp_appo(chat->id());
+	switch (chat->ss) {
+	case SubState::Ask:
+		return show_doctors(chat, bot, nullptr);
 	case SubState::ProcAnsw:
 		switch (str_hash(query->data)) {
 		case str_hash("ret"):
@@ -290,12 +662,10 @@ bool hdl_PA_select_doctor(const std::shared_ptr<const Chat>& chat,
 			return false;
 		case str_hash("prev"):
 			--appo.doc_n;
-			set_chat_state(chat->id(), chat->ms, SubState::Ask);
-			return false;
+			return show_doctors(chat, bot, query);
 		case str_hash("next"):
 			appo.doc_n++;
-			set_chat_state(chat->id(), chat->ms, SubState::Ask);
-			return false;
+			return show_doctors(chat, bot, query);
 		case str_hash("nan"):
 			set_chat_state(chat->id(), chat->ms, SubState::Invalid);
 			return false;
@@ -304,6 +674,26 @@ bool hdl_PA_select_doctor(const std::shared_ptr<const Chat>& chat,
 				MainState::PASelectTime, SubState::Ask);
 			return false;
 		}
+		case str_hash("soonest"): {
+			auto offers = earliest_available(appo.spec, appo.clinic, 1,
+				appo.from, appo.to);
+			if (offers.empty()) {
+				set_chat_state(chat->id(), chat->ms, SubState::Invalid);
+				return false;
+			}
+			appo.doc = offers[0].doctor;
+			appo.res = offers[0].time;
+			set_chat_state(chat->id(), MainState::PASetPersInfo);
+			return false;
+		}
+		case str_hash("wait"):
+			join_waitlist(chat->id(), appo.spec, appo.clinic,
+				appo.from, appo.to);
+			send_message(tm(), "waitlist", chat, bot,
+				tm()("waitlist", "added"));
+			chat->last_msg_id = 0;
+			set_chat_state(chat->id(), MainState::MainMenu, SubState::Ask);
+			return false;
 		}
 	case SubState::Invalid:
 		send_message(tm(), "select_doc", chat, bot,
@@ -323,58 +713,138 @@ bool hdl_PA_nearest_time(const std::shared_ptr<const Chat>& chat,
 	return false;
 }
 
+static TgBot::GenericReply::Ptr build_slots_keyboard(id_t doc, id_t spec,
+	time_t day, bool has_prev)
+{
+	std::vector<std::string> kb_text;
+	std::vector<std::string> kb_data;
+	for (time_t t : FreeSlots(doc, spec, day, day)) {
+		kb_text.push_back(time_to_hh_mm(t));
+		kb_data.push_back(std::to_string(t));
+	}
+
+	size_t len = kb_text.size();
+	int rows = (len + 3) / 4;
+	std::vector<int> kb_markup(rows + 2, 4);
+	kb_markup[rows] = 2;
+	kb_markup[rows + 1] = 1;
+	kb_text.resize(rows * 4 + 3);
+	kb_data.resize(rows * 4 + 3);
+
+	int right_offset = 4 - len % 4;
+	if (right_offset == 4)
+		right_offset = 0;
+	for (int i = 0; i < right_offset; ++i) {
+		kb_text[len + i] = u8"\u200B";
+		kb_data[len + i] = "nan";		
+	}
+
+	time_t prev_day = add_days(day, -1);
+	time_t next_day = add_days(day, 1);
+	if (!has_prev) {
+		kb_text[len + right_offset] = u8"\u200B";
+		kb_data[len + right_offset] = "nan";
+	} else {
+		kb_text[len + right_offset] = "<- " + time_to_mm_dd(prev_day);
+		kb_data[len + right_offset] = "prev";
+	}
+
+	kb_text[len + right_offset + 1] = time_to_mm_dd(next_day) + " ->";
+	kb_data[len + right_offset + 1] = "next";
+
+	kb_text[len + right_offset + 2] = tm()("input_time", "text_ret");
+	kb_data[len + right_offset + 2] = "ret";
+
+	return keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data);
+}
+
+struct SlotsKey
+{
+	id_t doc;
+	id_t spec;
+	time_t day;
+	TextManager::Language lang;
+	bool has_prev;
+
+	bool operator==(const SlotsKey& k) const
+	{
+		return doc == k.doc && spec == k.spec && day == k.day &&
+			lang == k.lang && has_prev == k.has_prev;
+	}
+};
+
+struct SlotsKeyHash
+{
+	size_t operator()(const SlotsKey& k) const
+	{
+		return std::hash<uint64_t>()(
+			((uint64_t)k.doc << 40) ^ ((uint64_t)k.spec << 24) ^
+			((uint64_t)(k.day / 3600) << 2) ^ ((uint64_t)k.lang << 1) ^
+			k.has_prev);
+	}
+};
+
+// свободные слоты врача: и записи, и удержания другими чатами
+static uint64_t slots_version(id_t doctor)
+{
+	return availability_version() + holds_version(doctor);
+}
+
+// клавиатура дня одна на всех, кто смотрит этого врача; устаревает
+// со сменой slots_version()
+static CarouselPage render_slots(const Chat::Tmp& appo, time_t day)
+{
+	static std::mutex mtx;
+	static LruCache<SlotsKey, TgBot::GenericReply::Ptr, SlotsKeyHash> slots {256};
+
+	// вчерашний день листать нельзя
+	SlotsKey key {appo.doc, appo.spec, day, tm().lang,
+		add_days(day, -1) >= time(0)};
+	uint64_t ver = slots_version(appo.doc);
+	TgBot::GenericReply::Ptr kb;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (auto res = slots.get(key, ver))
+			kb = *res;
+	}
+	if (kb == nullptr) {
+		kb = build_slots_keyboard(key.doc, key.spec, day, key.has_prev);
+		std::lock_guard<std::mutex> lock(mtx);
+		slots.put(key, ver, kb);
+	}
+	return {day, tm()("input_time", "prompt"), kb, 0, 0, std::time(0)};
+}
+
+static bool show_slots(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::CallbackQuery::Ptr query)
+{
+	auto& appo = get_tmp_appo(chat->id());
+	render_f render = [chat](int64_t day) {
+		return render_slots(get_tmp_appo(chat->id()), day);
+	};
+	uint64_t ctx = ctx_hash({appo.doc, appo.spec});
+	id_t doc = appo.doc;
+	auto page = get_page(chat, ctx, slots_version(doc), appo.day, render);
+	show_page("input_time", chat, bot, query, page);
+	set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
+
+	std::vector<int64_t> next {add_days(appo.day, 1)};
+	if (add_days(appo.day, -1) >= time(0))
+		next.push_back(add_days(appo.day, -1));
+	prerender(chat, ctx, next, render, [doc]() { return slots_version(doc); });
+	return true;
+}
+
 // добавить проверку, чтою не раньше сегодня
 bool hdl_PA_input_time(const std::shared_ptr<const Chat>& chat,
 	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
 {
 	auto& appo = get_tmp_appo(chat->id());
 	switch (chat->ss) {
-	case SubState::Ask: {
+	case SubState::Ask:
 		if (appo.day == 0)
 			appo.day = appo.from;
-		
-		auto times = all_available_in_day(appo.doc, appo.spec, appo.day);
-		size_t len = times.size();
-		int rows = (len + 3) / 4;
-		std::vector<int> kb_markup(rows + 2, 4);
-		kb_markup[rows] = 2;
-		kb_markup[rows + 1] = 1;
-
-		std::vector<std::string> kb_text(rows * 4 + 3);
-		std::vector<std::string> kb_data(rows * 4 + 3);
-		for (size_t i = 0; i < len; ++i) {
-			kb_text[i] = time_to_hh_mm(times[i]);
-			kb_data[i] = std::to_string(times[i]);
-		}
-
-		int right_offset = 4 - len % 4;
-		if (right_offset == 4)
-			right_offset = 0;
-		for (int i = 0; i < right_offset; ++i) {
-			kb_text[len + i] = u8"\u200B";
-			kb_data[len + i] = "nan";		
-		}
-
-		if (appo.day - 24*3600 < time(0)) {
-			kb_text[len + right_offset] = u8"\u200B";
-			kb_data[len + right_offset] = "nan";
-		} else {
-			kb_text[len + right_offset] = "<- " + time_to_mm_dd(appo.day - 24*3600);
-			kb_data[len + right_offset] = "prev";
-		}
-
-		kb_text[len + right_offset + 1] = time_to_mm_dd(appo.day + 24*3600) + " ->";
-		kb_data[len + right_offset + 1] = "next";
-
-		kb_text[len + right_offset + 2] = tm()("input_time", "text_ret");
-		kb_data[len + right_offset + 2] = "ret";
-
-		std::string text = tm()("input_time", "prompt");
-		auto kb = keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data);
-		send_message(tm(), "input_time", chat, bot, text, nullptr, kb);
-		set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
-		return true;
-	}
+		return show_slots(chat, bot, nullptr);
 	case SubState::ProcAnsw: {
 		switch (str_hash(query->data)) {
 		case str_hash("ret"):
@@ -382,13 +852,11 @@ bool hdl_PA_input_time(const std::shared_ptr<const Chat>& chat,
 			set_chat_state(chat->id(), MainState::PASelectTime, SubState::Ask);
 			return false;
 		case str_hash("next"):
-			appo.day += 24*3600;
-			set_chat_state(chat->id(), chat->ms, SubState::Ask);
-			return false;
+			appo.day = add_days(appo.day, 1);
+			return show_slots(chat, bot, query);
 		case str_hash("prev"):
-			appo.day -= 24*3600;
-			set_chat_state(chat->id(), chat->ms, SubState::Ask);
-			return false;
+			appo.day = add_days(appo.day, -1);
+			return show_slots(chat, bot, query);
 		case str_hash("nan"):
 			set_chat_state(chat->id(), chat->ms, SubState::Invalid);
 			return false;
@@ -497,9 +965,16 @@ bool hdl_PA_set_pers_info(const std::shared_ptr<const Chat>& chat,
 bool hdl_PA_confirm(const std::shared_ptr<const Chat>& chat,
 	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
 {
+	auto& appo = get_tmp_appo(chat->id());
 	switch (chat->ss) {
 	case SubState::Ask: {
-		auto& appo = get_tmp_appo(chat->id());
+		if (!hold_slot(chat->id(), appo.doc, appo.spec, appo.res,
+				config().num("holds", "confirm_ttl"))) {
+			appo.from = appo.to = appo.year = appo.month = 0;
+			set_chat_state(chat->id(), MainState::PACantMake, SubState::Ask);
+			return false;
+		}
+
 		std::string addr = appo.clinic ?
 			get_clinic(appo.clinic)->address :
 			get_doctor(appo.doc)->clinic->address;
@@ -517,9 +992,10 @@ bool hdl_PA_confirm(const std::shared_ptr<const Chat>& chat,
 		return true;
 	}
 	case SubState::ProcAnsw:
-		if (query->data == "ret")
+		if (query->data == "ret") {
+			release_hold(chat->id(), appo.doc);
 			set_chat_state(chat->id(), MainState::PASelectTime, SubState::Ask);
-		else {
+		} else {
 			remove_inline_keyboard(bot, query);
 			chat->last_msg_id = 0;
 		 	set_chat_state(chat->id(), MainState::PAMake);
@@ -533,15 +1009,13 @@ bool hdl_PA_make(const std::shared_ptr<const Chat>& chat,
 	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
 {
 	auto& appo = get_tmp_appo(chat->id());
-	if (appointment_exist(appo.doc, appo.spec, appo.res)) {
+	if (!try_book(chat->user->client.id(), appo.doc,
+			appo.spec, appo.res, appo.clinic, chat->id())) {
 		appo.from = appo.to = appo.year = appo.month = 0;
 		set_chat_state(chat->id(), MainState::PACantMake, SubState::Ask);
 		return false;
 	}
 
-	make_appointment(chat->user->client.id(), appo.doc,
-		appo.spec, appo.res, appo.clinic);
-
 	send_message(tm(), "make_appo", chat, bot, tm()("make_appo", "text"));
 	set_chat_state(chat->id(), MainState::MainMenu, SubState::Ask);
 	chat->last_msg_id = 0;
@@ -549,74 +1023,167 @@ bool hdl_PA_make(const std::shared_ptr<const Chat>& chat,
 	return false;
 }
 
-bool hdl_list_appointments(const std::shared_ptr<const Chat>& chat,
+bool hdl_PA_cant_make(const std::shared_ptr<const Chat>& chat,
 	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
 {
-	auto& tmp = get_tmp_appo(chat->id());
-	auto appos = get_client_appointments(chat->user->client.id());
-	if (appos.empty())
-		return generic_handler(tm(), "list_appos", chat, bot, msg, query);
-
-	switch (chat->ss) {
-	case SubState::Ask: {
-		tmp.canc_id = appos[tmp.display_appo]->id();
-		int max_units_per_page = tm().get("list_appos", "max_per_page").GetInt();
-		int from, to;
-		if (appos.size() > max_units_per_page) {
-			from = std::max(0, tmp.display_appo - max_units_per_page / 2);
-			to = std::min((int)appos.size(),
-				tmp.display_appo + max_units_per_page / 2 + 1);
-		} else {
-			from = 0;
-			to = appos.size();
+	auto& appo = get_tmp_appo(chat->id());
+	return generic_handler(tm(), "cant_make", chat, bot, msg, query, [&]() {
+		if (query->data == "wait") {
+			join_waitlist(chat->id(), appo.spec, appo.clinic,
+				appo.res, appo.res);
+			send_message(tm(), "waitlist", chat, bot,
+				tm()("waitlist", "added"));
 		}
+		return false;
+	});
+}
 
-		std::string text = tm()("list_appos", "text_you_have_n_appos") +
-			std::to_string(appos.size()) + "\n\n";
-		for (int i = from; i < to; ++i) {
-			const auto& a = appos[i];
-			text += std::to_string(i + 1) + ")\n";
-			if (i == tmp.display_appo)
-				text += "<u>";
+bool hdl_waitlist_offer(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::CallbackQuery::Ptr query)
+{
+	std::istringstream in(query->data);
+	std::string cmd;
+	id_t doc, spec;
+	time_t time;
+	if (!(in >> cmd >> doc >> spec >> time))
+		return false;
 
-			text += format_appointment(tm(), a->speciality->title,
-				a->doctor->full_name, a->clinic->address,
-					a->time.from, "    ");
+	if (cmd != "wl_accept") {
+		release_hold(chat->id(), doc);
+		if (query->message)
+			remove_inline_keyboard(bot, query);
+		return false;
+	}
 
-			if (i == tmp.display_appo)
-				text += "</u>";
+	auto& appo = get_tmp_appo(chat->id());
+	appo = {};
+	appo.spec = spec;
+	appo.doc = doc;
+	appo.res = time;
+	// у старых сообщений телеграм не присылает message, тогда
+	// подтверждение уйдет новым сообщением
+	if (query->message)
+		chat->last_msg_id = query->message->messageId;
+	set_chat_state(chat->id(), MainState::PAConfirm, SubState::Ask);
+	return true;
+}
 
-			text += "\n\n";
-		}
+// total пересчитывается здесь же: к отрисовке соседей записи могли отменить
+static CarouselPage render_appointments(id_t client, time_t since, size_t n)
+{
+	size_t total = get_client_appointments(client, 0, 0, since).total;
+	if (n >= total)
+		return {(int64_t)n, "", nullptr, 0, total, std::time(0)};
+
+	size_t max_units_per_page = tm().get("list_appos", "max_per_page").GetInt();
+	size_t from, to;
+	if (total > max_units_per_page) {
+		from = n > max_units_per_page / 2 ? n - max_units_per_page / 2 : 0;
+		to = std::min(total, n + max_units_per_page / 2 + 1);
+	} else {
+		from = 0;
+		to = total;
+	}
 
-		std::vector<int> kb_markup;
-		std::vector<std::string> kb_text;
-		std::vector<std::string> kb_data;
+	// с индекса берется только видимое окно
+	auto page = get_client_appointments(client, from, to - from, since);
+	if (n - from >= page.items.size())
+		return {(int64_t)n, "", nullptr, 0, total, std::time(0)};
+	id_t item = page.items[n - from]->id();
 
-		if (appos.size() > 1) {
-			kb_markup = tm().int_vec("list_appos", "kb_markup2");
-			kb_text = tm().vec("list_appos", "kb_text2");
-			kb_data = tm().vec("list_appos", "kb_data2");
-
-			if (tmp.display_appo == 0) {
-				kb_text[1] = u8"\u200B";
-				kb_data[1] = "nan";
-			} else if (tmp.display_appo == appos.size() - 1) {
-				kb_text[2] = u8"\u200B";
-				kb_data[2] = "nan";
-			}
-		} else {
-			kb_markup = tm().int_vec("list_appos", "kb_markup1");
-			kb_text = tm().vec("list_appos", "kb_text1");
-			kb_data = tm().vec("list_appos", "kb_data1");
+	std::string text = tm()("list_appos", "text_you_have_n_appos") +
+		std::to_string(total) + "\n\n";
+	for (size_t i = from; i < from + page.items.size(); ++i) {
+		const auto& a = page.items[i - from];
+		text += std::to_string(i + 1) + ")\n";
+		if (i == n)
+			text += "<u>";
+
+		text += format_appointment(tm(), a->speciality->title,
+			a->doctor->full_name, a->clinic->address,
+				a->time.from, "    ");
+
+		if (i == n)
+			text += "</u>";
+
+		text += "\n\n";
+	}
+
+	std::vector<int> kb_markup;
+	std::vector<std::string> kb_text;
+	std::vector<std::string> kb_data;
+
+	if (total > 1) {
+		kb_markup = tm().int_vec("list_appos", "kb_markup2");
+		kb_text = tm().vec("list_appos", "kb_text2");
+		kb_data = tm().vec("list_appos", "kb_data2");
+
+		if (n == 0) {
+			kb_text[1] = u8"\u200B";
+			kb_data[1] = "nan";
+		} else if (n == total - 1) {
+			kb_text[2] = u8"\u200B";
+			kb_data[2] = "nan";
 		}
+	} else {
+		kb_markup = tm().int_vec("list_appos", "kb_markup1");
+		kb_text = tm().vec("list_appos", "kb_text1");
+		kb_data = tm().vec("list_appos", "kb_data1");
+	}
 
-		auto kb = keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data);
-		send_message(tm(), "list_appos", chat, bot,
-			text, nullptr, kb);
-		set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
-		return true;
+	auto kb = keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data);
+	return {(int64_t)n, text, kb, item, total, std::time(0)};
+}
+
+static bool show_appointments(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::CallbackQuery::Ptr query, time_t since,
+	size_t total)
+{
+	auto& tmp = get_tmp_appo(chat->id());
+	id_t client = chat->user->client.id();
+	tmp.display_appo = std::min(tmp.display_appo, total - 1);
+	render_f render = [client, since](int64_t n) {
+		return render_appointments(client, since, n);
+	};
+	uint64_t ctx = ctx_hash({client, since != 0, total});
+	auto page = get_page(chat, ctx, appointments_version(),
+		tmp.display_appo, render);
+	if (!page_exists(page)) {
+		// все записи отменили между подсчетом и отрисовкой
+		if (page.count == 0) {
+			set_chat_state(chat->id(), chat->ms, SubState::Ask);
+			return false;
+		}
+		tmp.display_appo = page.count - 1;
+		page = render(tmp.display_appo);
 	}
+	tmp.canc_id = page.item;
+
+	show_page("list_appos", chat, bot, query, page);
+	set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
+
+	std::vector<int64_t> next;
+	if (tmp.display_appo > 0)
+		next.push_back(tmp.display_appo - 1);
+	if (tmp.display_appo + 1 < page.count)
+		next.push_back(tmp.display_appo + 1);
+	prerender(chat, ctx, next, render, appointments_version);
+	return true;
+}
+
+bool hdl_list_appointments(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
+{
+	auto& tmp = get_tmp_appo(chat->id());
+	id_t client = chat->user->client.id();
+	time_t since = tm().has("list_appos", "hide_past") ? std::time(0) : 0;
+	size_t total = get_client_appointments(client, 0, 0, since).total;
+	if (total == 0)
+		return generic_handler(tm(), "list_appos", chat, bot, msg, query);
+
+	switch (chat->ss) {
+	case SubState::Ask:
+		return show_appointments(chat, bot, nullptr, since, total);
 	case SubState::ProcAnsw: {
 		switch (str_hash(query->data)) {
 		case str_hash("ret"):
@@ -628,12 +1195,10 @@ bool hdl_list_appointments(const std::shared_ptr<const Chat>& chat,
 			return false;
 		case str_hash("prev"):
 			--tmp.display_appo;
-			set_chat_state(chat->id(), chat->ms, SubState::Ask);
-			return false;
+			return show_appointments(chat, bot, query, since, total);
 		case str_hash("next"):
 			++tmp.display_appo;
-			set_chat_state(chat->id(), chat->ms, SubState::Ask);
-			return false;
+			return show_appointments(chat, bot, query, since, total);
 		case str_hash("canc"):
 			set_chat_state(chat->id(), MainState::ConfirmCancel, SubState::Ask);
 			return false;
@@ -664,57 +1229,192 @@ bool hdl_confirm_appointment_cancellation(const std::shared_ptr<const Chat>& cha
 	});
 }
 
-bool hdl_list_doctors(const std::shared_ptr<const Chat>& chat,
+// запись сразу к найденному врачу, по его первой специальности
+// к врачу с несколькими специальностями запись идет по одной из них,
+// спрашиваем по какой; spec 0 - еще не выбрана
+static bool find_doctor_chosen(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, const std::shared_ptr<const Doctor>& doc, id_t spec)
+{
+	if (!spec && doc->specialities.size() > 1) {
+		std::vector<int> kb_markup;
+		std::vector<std::string> kb_text;
+		std::vector<std::string> kb_data;
+		for (id_t s : doc->specialities) {
+			kb_markup.push_back(1);
+			kb_text.push_back(get_speciality(s)->title);
+			kb_data.push_back("spec " + std::to_string(doc->id()) + " " +
+				std::to_string(s));
+		}
+		send_message(tm(), "find_doc", chat, bot,
+			tm()("find_doc", "choose_spec"), nullptr,
+			keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data));
+		return true;
+	}
+
+	remove_reply_keyboard(bot, chat->chat_id);
+	chat->last_msg_id = 0;
+
+	// как и при выборе дат, записаться можно с завтрашнего дня
+	auto& appo = get_tmp_appo(chat->id());
+	appo = {};
+	appo.spec = spec ? spec : *doc->specialities.begin();
+	appo.clinic = doc->clinic.id();
+	appo.doc = doc->id();
+	appo.from = appo.day = add_days(day_start(std::time(0)), 1);
+	appo.to = add_days(appo.from, 30);
+	set_chat_state(chat->id(), MainState::PASelectTime, SubState::Ask);
+	return false;
+}
+
+bool hdl_find_doctor(const std::shared_ptr<const Chat>& chat,
 	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
 {
-	auto& tmp = get_tmp_appo(chat->id());
-	switch (chat->ss) {
-	case SubState::Ask: {
+	if (chat->ss != SubState::ProcAnsw)
+		return generic_handler(tm(), "find_doc", chat, bot, msg, query);
+
+	// выбор среди тезок или специальности: "doc <врач>", "spec <врач> <spec>"
+	if (query) {
+		std::istringstream in(query->data);
+		std::string cmd;
+		id_t doc = 0, spec = 0;
+		in >> cmd >> doc >> spec;
+		auto found = has_doctor(doc) ? get_doctor(doc) : nullptr;
+		if (found == nullptr || found->specialities.size() == 0 ||
+				(cmd == "spec" && !found->specialities.has(spec))) {
+			set_chat_state(chat->id(), chat->ms, SubState::Invalid);
+			return false;
+		}
+		return find_doctor_chosen(chat, bot, found, cmd == "spec" ? spec : 0);
+	}
+
+	if (msg->text == tm()("find_doc", "return_btn_text")) {
+		set_chat_state(chat->id(), MainState::MainMenu, SubState::Ask);
+		remove_reply_keyboard(bot, chat->chat_id);
+		chat->last_msg_id = 0;
+		return false;
+	}
+
+	bool unique = false;
+	auto docs = find_doctors(msg->text, tm().num("find_doc", "kb_limit"), &unique);
+	if (docs.empty() || (unique && docs[0]->specialities.size() == 0)) {
+		set_chat_state(chat->id(), chat->ms, SubState::Invalid);
+		return false;
+	}
+	if (unique)
+		return find_doctor_chosen(chat, bot, docs[0], 0);
+
+	// у тезок одинаковые имена, поэтому различаем их по клинике
+	std::vector<int> kb_markup;
+	std::vector<std::string> kb_text;
+	std::vector<std::string> kb_data;
+	for (const auto& d : docs) {
+		if (d->specialities.size() == 0)
+			continue;
+		kb_markup.push_back(1);
+		kb_text.push_back(d->full_name + ", " + d->clinic->address);
+		kb_data.push_back("doc " + std::to_string(d->id()));
+	}
+	send_message(tm(), "find_doc", chat, bot, tm()("find_doc", "refine"),
+		nullptr, keyboard(KeyboardType::Inline, kb_markup, kb_text, kb_data));
+	return true;
+}
+
+// справочник, заранее разбитый на страницы не длиннее text_limit;
+// пересобирается только при смене directory_version()
+static size_t doctors_page(size_t page, std::string& text)
+{
+	static std::mutex mtx;
+	static LruCache<TextManager::Language, std::vector<std::string>> pages {4};
+
+	std::lock_guard<std::mutex> lock(mtx);
+	uint64_t ver = directory_version();
+	auto res = pages.get(tm().lang, ver);
+	if (res == nullptr) {
 		auto specs = get_all_specialities();
 		std::sort(specs.begin(), specs.end(), [](const auto& s1, const auto& s2) {
 			return s1->title < s2->title;
 		});
 
-		std::string text;
-		int curr_page = 0;
-		int text_limit = tm().num("doctors", "text_limit");
-		tmp.docs_has_next_page = false;
+		std::vector<std::string> rendered(1);
+		size_t text_limit = tm().num("doctors", "text_limit");
 		for (const auto& spec : specs) {
 			std::string more_text = "<b>" + spec->title + "</b>\n";
 			for (id_t doc : spec->doctors)
 				more_text += "    " + get_doctor(doc)->full_name + "\n";
 			more_text += "\n";
 
-			if (text.size() + more_text.size() > text_limit) {
-				if (curr_page == tmp.docs_page) {
-					tmp.docs_has_next_page = true;
-					break;
-				}
-				text = more_text;
-				++curr_page;
-			} else {
-				text += more_text;
-			}
+			if (!rendered.back().empty() &&
+				rendered.back().size() + more_text.size() > text_limit)
+				rendered.emplace_back();
+			rendered.back() += more_text;
 		}
+		res = &pages.put(tm().lang, ver, std::move(rendered));
+	}
 
-		auto kb_markup = tm().int_vec("doctors", "kb_markup");
-		auto kb_text = tm().vec("doctors", "kb_text");
-		auto kb_data = tm().vec("doctors", "kb_data");
+	if (page < res->size())
+		text = (*res)[page];
+	return res->size();
+}
 
-		if (tmp.docs_page == 0) {
-			kb_text[0] = u8"\u200B";
-			kb_data[0] = "nan";
-		} else if (!tmp.docs_has_next_page) {
-			kb_text[1] = u8"\u200B";
-			kb_data[1] = "nan";
-		}
+static CarouselPage render_doctors(size_t n)
+{
+	std::string text;
+	size_t pages = doctors_page(n, text);
+	if (n >= pages)
+		return {(int64_t)n, "", nullptr, 0, pages, std::time(0)};
+
+	auto kb_markup = tm().int_vec("doctors", "kb_markup");
+	auto kb_text = tm().vec("doctors", "kb_text");
+	auto kb_data = tm().vec("doctors", "kb_data");
+
+	if (n == 0) {
+		kb_text[0] = u8"\u200B";
+		kb_data[0] = "nan";
+	}
+	if ((size_t)n + 1 >= pages) {
+		kb_text[1] = u8"\u200B";
+		kb_data[1] = "nan";
+	}
 
-		auto kb = keyboard(KeyboardType::Inline,
-			kb_markup, kb_text, kb_data);
-		send_message(tm(), "doctors", chat, bot, text, nullptr, kb);
-		set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
-		return true;
+	auto kb = keyboard(KeyboardType::Inline,
+		kb_markup, kb_text, kb_data);
+	return {(int64_t)n, text, kb, 0, pages, std::time(0)};
+}
+
+static bool show_doctors_list(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::CallbackQuery::Ptr query)
+{
+	auto& tmp = get_tmp_appo(chat->id());
+	render_f render = [](int64_t n) { return render_doctors(n); };
+	uint64_t ctx = ctx_hash({});
+	auto page = get_page(chat, ctx, directory_version(),
+		tmp.docs_page, render);
+	if (!page_exists(page)) {
+		// справочник мог сократиться, пока чат листал
+		tmp.docs_page = page.count - 1;
+		page = render(tmp.docs_page);
 	}
+	tmp.docs_has_next_page = tmp.docs_page + 1 < page.count;
+
+	show_page("doctors", chat, bot, query, page);
+	set_chat_state(chat->id(), chat->ms, SubState::ProcAnsw);
+
+	std::vector<int64_t> next;
+	if (tmp.docs_page > 0)
+		next.push_back(tmp.docs_page - 1);
+	if (tmp.docs_has_next_page)
+		next.push_back(tmp.docs_page + 1);
+	prerender(chat, ctx, next, render, directory_version);
+	return true;
+}
+
+bool hdl_list_doctors(const std::shared_ptr<const Chat>& chat,
+	TgBot::Bot& bot, TgBot::Message::Ptr msg, TgBot::CallbackQuery::Ptr query)
+{
+	auto& tmp = get_tmp_appo(chat->id());
+	switch (chat->ss) {
+	case SubState::Ask:
+		return show_doctors_list(chat, bot, nullptr);
 	case SubState::ProcAnsw: {
 		switch (str_hash(query->data)) {
 		case str_hash("ret"):
@@ -723,12 +1423,10 @@ bool hdl_list_doctors(const std::shared_ptr<const Chat>& chat,
 			return false;
 		case str_hash("prev"):
 			--tmp.docs_page;
-			set_chat_state(chat->id(), chat->ms, SubState::Ask);
-			return false;
+			return show_doctors_list(chat, bot, query);
 		case str_hash("next"):
 			++tmp.docs_page;
-			set_chat_state(chat->id(), chat->ms, SubState::Ask);
-			return false;
+			return show_doctors_list(chat, bot, query);
 		case str_hash("nan"):
 			set_chat_state(chat->id(), chat->ms, SubState::Invalid);
 			return false;
@@ -773,7 +1471,7 @@ EventHandler::EventHandler()
 	add_hdl(MainState::PASetPersInfo, hdl_PA_set_pers_info);
 	add_hdl(MainState::PAConfirm, hdl_PA_confirm);
 	add_hdl(MainState::PAMake, hdl_PA_make);
-	add_hdl(MainState::PACantMake, generic_reply("cant_make"));
+	add_hdl(MainState::PACantMake, hdl_PA_cant_make);
 
 	add_hdl(MainState::StateInsuranceApp, generic_reply("state_ins"));
 	add_hdl(MainState::PrivateInsuranceApp, generic_reply("priv_ins"));
@@ -785,6 +1483,8 @@ EventHandler::EventHandler()
 
 	add_hdl(MainState::ListAppointments, hdl_list_appointments);
 	add_hdl(MainState::ConfirmCancel, hdl_confirm_appointment_cancellation);
+
+	add_hdl(MainState::FindDoctor, hdl_find_doctor);
 }
 
 void EventHandler::handle(MainState& state, const std::shared_ptr<const Chat>& chat,
@@ -809,7 +1509,12 @@ bool EventHandler::is_input_valid(const MainState& state,
 	TgBot::CallbackQuery::Ptr query)
 {
 	std::string state_name = tm()("states", std::to_string((int)state).c_str());
-	if (tm().has(state_name.c_str(), "msg_expected") ^ !!msg)
+	// query_expected - кроме текста принимаются и нажатия на кнопки
+	bool msg_expected = (tm().has(state_name.c_str(), "msg_expected") &&
+		!(query && tm().has(state_name.c_str(), "query_expected"))) ||
+		(msg && msg->location &&
+		tm().has(state_name.c_str(), "location_expected"));
+	if (msg_expected ^ !!msg)
 		return false;
 
 	if (query && (chat->last_query_msg_date ==
@@ -0,0 +1,442 @@
+#include "bot/indexes.h"
+#include "bot/calendar.h"
+#include "bot/database.h"
+#include "bot/logic.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+static inline DB1& db()
+{
+	return DB1::get_instance();
+}
+
+// свободные слоты врача по spec за день без учета удержаний; если задан
+// within, считаются только пересекающиеся с ним слоты
+static int count_free(const Doctor& doc, const Speciality& spec, time_t day,
+	const Period* within=nullptr)
+{
+	time_t from = day;
+	if (within)
+		from = std::max(day, within->from - spec.appointment_duration + 1);
+
+	int res = 0;
+	for (time_t t : FreeSlots(doc.id(), spec.id(), from, day, false)) {
+		if (within && t > within->to)
+			break;
+		++res;
+	}
+	return res;
+}
+
+// врачи специальности считаются одним пакетом по всем дням их расписаний
+void FreeSlotIndex::rebuild()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	counts.clear();
+	for (const auto& spec : db().specialties.all()) {
+		time_t first = 0, last = 0;
+		for (id_t id : spec->doctors) {
+			auto doc = db().doctors.get(id);
+			if (doc->work_sch.is_null())
+				continue;
+			for (const auto& kv : doc->work_sch->ws) {
+				first = first ? std::min(first, kv.first) : kv.first;
+				last = std::max(last, kv.first);
+			}
+		}
+		if (!first)
+			continue;
+
+		auto avail = availability(spec->id(), 0, first, last,
+			std::chrono::milliseconds(0), false);
+		for (size_t i = 0; i < avail.doctors.size(); ++i) {
+			id_t clinic = db().doctors.get(avail.doctors[i])->clinic.id();
+			for (size_t d = 0; d < avail.days.size(); ++d)
+				add(spec->id(), clinic, avail.days[d], avail.count(i, d));
+		}
+	}
+}
+
+int FreeSlotIndex::free_slots(id_t spec, id_t clinic, time_t day) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto itr = counts.find({spec, clinic, day});
+	return itr == counts.end() ? 0 : itr->second;
+}
+
+// sign = -1 - запись появилась, +1 - исчезла; вызывается, пока записи
+// нет в индексе записей врача
+void FreeSlotIndex::on_appointment(const Appointment& appo, int sign)
+{
+	if (appo.doctor.is_null())
+		return;
+
+	auto doc = appo.doctor.get();
+	time_t day = day_start(appo.time.from);
+	std::lock_guard<std::mutex> lock(mtx);
+	for (id_t spec : doc->specialities) {
+		int n = count_free(*doc, *db().specialties.get(spec), day, &appo.time);
+		add(spec, doc->clinic.id(), day, sign * n);
+	}
+}
+
+void FreeSlotIndex::on_schedule(const Doctor& doc, time_t day, int sign)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	for (id_t spec : doc.specialities) {
+		int n = count_free(doc, *db().specialties.get(spec), day);
+		add(spec, doc.clinic.id(), day, sign * n);
+	}
+}
+
+void FreeSlotIndex::add(id_t spec, id_t clinic, time_t day, int n)
+{
+	if (n == 0)
+		return;
+	if (clinic)
+		counts[{spec, clinic, day}] += n;
+	counts[{spec, 0, day}] += n;
+}
+
+bool DoctorsIndex::insert(const Doctor& doc)
+{
+	std::vector<Key> doc_keys;
+	for (int64_t clinic : {(int64_t)doc.clinic.id(), (int64_t)0}) {
+		doc_keys.push_back({0, clinic});
+		for (id_t spec : doc.specialities)
+			doc_keys.push_back({spec, clinic});
+		if (clinic == 0)
+			break;
+	}
+	// порядок специальностей в множестве не важен
+	std::sort(doc_keys.begin(), doc_keys.end());
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto itr = keys.find(doc.id());
+	if (itr != keys.end() && itr->second == doc_keys)
+		return false;
+
+	erase_locked(doc.id());
+	for (const auto& k : doc_keys) {
+		auto& list = lists[k];
+		auto vec = list ? *list : std::vector<id_t>();
+		vec.insert(std::upper_bound(vec.begin(), vec.end(), doc.id()), doc.id());
+		list = std::make_shared<const std::vector<id_t>>(std::move(vec));
+	}
+	keys[doc.id()] = std::move(doc_keys);
+	return true;
+}
+
+void DoctorsIndex::erase(id_t doc)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	erase_locked(doc);
+}
+
+void DoctorsIndex::erase_locked(id_t doc)
+{
+	auto itr = keys.find(doc);
+	if (itr == keys.end())
+		return;
+
+	for (const auto& k : itr->second) {
+		auto list = lists.find(k);
+		if (list == lists.end())
+			continue;
+		auto vec = *list->second;
+		auto i = std::lower_bound(vec.begin(), vec.end(), doc);
+		if (i != vec.end() && *i == doc)
+			vec.erase(i);
+		if (vec.empty())
+			lists.erase(list);
+		else
+			list->second = std::make_shared<const std::vector<id_t>>(std::move(vec));
+	}
+	keys.erase(itr);
+}
+
+DoctorsIndex::List DoctorsIndex::get(id_t spec, id_t clinic) const
+{
+	static const List empty = std::make_shared<const std::vector<id_t>>();
+	std::lock_guard<std::mutex> lock(mtx);
+	auto itr = lists.find({spec, clinic});
+	return itr == lists.end() ? empty : itr->second;
+}
+
+static const double earth_radius_km = 6371;
+
+static void to_unit(double lat, double lon, double* x)
+{
+	double phi = lat * M_PI / 180;
+	double lambda = lon * M_PI / 180;
+	x[0] = std::cos(phi) * std::cos(lambda);
+	x[1] = std::cos(phi) * std::sin(lambda);
+	x[2] = std::sin(phi);
+}
+
+void GeoIndex::rebuild()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	points.clear();
+	coords.clear();
+	for (const auto& clinic : db().clinics.all()) {
+		if (!clinic->located)
+			continue;
+		coords[clinic->id()] = {clinic->lat, clinic->lon};
+		Point p;
+		to_unit(clinic->lat, clinic->lon, p.x);
+		p.id = clinic->id();
+		points.push_back(p);
+	}
+	build(0, points.size(), 0);
+}
+
+void GeoIndex::update(const Clinic& clinic)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = coords.find(clinic.id());
+		bool indexed = itr != coords.end();
+		if (indexed == clinic.located && (!indexed ||
+				itr->second == std::make_pair(clinic.lat, clinic.lon)))
+			return;
+	}
+	rebuild();
+}
+
+void GeoIndex::build(size_t lo, size_t hi, int depth)
+{
+	if (hi - lo <= 1)
+		return;
+
+	size_t mid = lo + (hi - lo) / 2;
+	int axis = depth % 3;
+	std::nth_element(points.begin() + lo, points.begin() + mid,
+		points.begin() + hi, [axis](const Point& a, const Point& b) {
+			return a.x[axis] < b.x[axis];
+		});
+	build(lo, mid, depth + 1);
+	build(mid + 1, hi, depth + 1);
+}
+
+void GeoIndex::search(size_t lo, size_t hi, int depth, const double* q,
+	size_t k, const filter_f& filter, Heap& heap) const
+{
+	if (lo >= hi)
+		return;
+
+	size_t mid = lo + (hi - lo) / 2;
+	const Point& p = points[mid];
+	double d2 = 0;
+	for (int i = 0; i < 3; ++i)
+		d2 += (p.x[i] - q[i]) * (p.x[i] - q[i]);
+
+	if ((heap.size() < k || d2 < heap.front().first) &&
+			(!filter || filter(p.id))) {
+		heap.push_back({d2, p.id});
+		std::push_heap(heap.begin(), heap.end());
+		if (heap.size() > k) {
+			std::pop_heap(heap.begin(), heap.end());
+			heap.pop_back();
+		}
+	}
+
+	int axis = depth % 3;
+	double diff = q[axis] - p.x[axis];
+	bool left_first = diff < 0;
+	if (left_first)
+		search(lo, mid, depth + 1, q, k, filter, heap);
+	else
+		search(mid + 1, hi, depth + 1, q, k, filter, heap);
+
+	// другая половина нужна, только если плоскость ближе худшего из найденных
+	if (heap.size() < k || diff * diff < heap.front().first) {
+		if (left_first)
+			search(mid + 1, hi, depth + 1, q, k, filter, heap);
+		else
+			search(lo, mid, depth + 1, q, k, filter, heap);
+	}
+}
+
+std::vector<std::pair<double, id_t>> GeoIndex::nearest(double lat, double lon,
+	size_t k, filter_f filter) const
+{
+	double q[3];
+	to_unit(lat, lon, q);
+
+	Heap heap;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		search(0, points.size(), 0, q, k, filter, heap);
+	}
+	std::sort_heap(heap.begin(), heap.end());
+	for (auto& h : heap)
+		h.first = 2 * earth_radius_km * std::asin(std::min(1.0, std::sqrt(h.first) / 2));
+	return heap;
+}
+
+void WaitlistIndex::insert(const WaitlistEntry& e)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	for (time_t d = day_start(e.dates.from); d <= e.dates.to; d = add_days(d, 1))
+		queues[{e.speciality.id(), e.clinic, d}].insert(e.id());
+	ends.insert({e.dates.to, e.id()});
+}
+
+void WaitlistIndex::erase(const WaitlistEntry& e)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	for (time_t d = day_start(e.dates.from); d <= e.dates.to; d = add_days(d, 1)) {
+		auto itr = queues.find({e.speciality.id(), e.clinic, d});
+		if (itr == queues.end())
+			continue;
+		itr->second.erase(e.id());
+		if (itr->second.empty())
+			queues.erase(itr);
+	}
+	ends.erase({e.dates.to, e.id()});
+}
+
+// заявка может быть на конкретную клинику или на любую
+id_t WaitlistIndex::match(id_t spec, id_t clinic, time_t time) const
+{
+	time_t day = day_start(time);
+	std::lock_guard<std::mutex> lock(mtx);
+	id_t res = 0;
+	for (id_t c : {clinic, (id_t)0}) {
+		auto itr = queues.find({spec, c, day});
+		if (itr != queues.end() && (!res || *itr->second.begin() < res))
+			res = *itr->second.begin();
+		if (!clinic)
+			break;
+	}
+	return res;
+}
+
+std::vector<id_t> WaitlistIndex::expired(time_t day) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	std::vector<id_t> res;
+	for (auto itr = ends.begin(); itr != ends.end() && itr->first < day; ++itr)
+		res.push_back(itr->second);
+	return res;
+}
+
+void WaitlistIndex::push_freed(const FreedSlot& slot)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	freed.push_back(slot);
+}
+
+std::vector<FreedSlot> WaitlistIndex::take_freed()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	std::vector<FreedSlot> res;
+	res.swap(freed);
+	return res;
+}
+
+Indexes::Indexes()
+{
+	// свободные слоты считаются через индекс записей врача
+	instance = this;
+	for (const auto& appo : db().appointments.all()) {
+		if (!appo->doctor.is_null())
+			doctor_appointments.insert(appo->doctor.id(), appo->time, appo->id());
+		if (!appo->client.is_null())
+			client_appointments.insert(appo->client.id(), appo->time, appo->id());
+		clinic_day.insert({appo->clinic.id(), day_start(appo->time.from)},
+			appo->time, appo->id());
+	}
+	for (const auto& e : db().waitlist.all())
+		waitlist.insert(*e);
+	for (const auto& spec : db().specialties.all())
+		specialities.insert(spec->id(), spec->title);
+	clinics_geo.rebuild();
+	for (const auto& doc : db().doctors.all()) {
+		doctors.insert(doc->id(), doc->full_name);
+		doctors_by_spec.insert(*doc);
+	}
+	// пересчет идет через availability(), ему нужен индекс врачей
+	free_slots.rebuild();
+
+	db().appointments.on_commit([this](const auto& appo) {
+		free_slots.on_appointment(*appo, -1);
+		if (!appo->doctor.is_null())
+			doctor_appointments.insert(appo->doctor.id(), appo->time, appo->id());
+		if (!appo->client.is_null())
+			client_appointments.insert(appo->client.id(), appo->time, appo->id());
+		clinic_day.insert({appo->clinic.id(), day_start(appo->time.from)},
+			appo->time, appo->id());
+	});
+	db().appointments.on_del([this](const auto& appo) {
+		if (!appo->doctor.is_null())
+			doctor_appointments.erase(appo->doctor.id(), appo->time, appo->id());
+		free_slots.on_appointment(*appo, 1);
+		if (!appo->client.is_null())
+			client_appointments.erase(appo->client.id(), appo->time, appo->id());
+		clinic_day.erase({appo->clinic.id(), day_start(appo->time.from)},
+			appo->time, appo->id());
+		// запись ещё не удалена, поэтому слот разбирается позже, вне этого вызова
+		if (!appo->doctor.is_null() && !appo->speciality.is_null())
+			waitlist.push_freed({appo->doctor.id(), appo->speciality.id(),
+				appo->clinic.id(), appo->time});
+	});
+	db().waitlist.on_commit([this](const auto& e) {
+		waitlist.insert(*e);
+	});
+	db().waitlist.on_del([this](const auto& e) {
+		waitlist.erase(*e);
+	});
+
+	db().specialties.on_commit([this](const auto& spec) {
+		specialities.insert(spec->id(), spec->title);
+		++directory_ver;
+	});
+	// touch бывает и без смены названия, например каскад обнулил связь
+	db().specialties.on_update([this](const auto& spec) {
+		if (specialities.insert(spec->id(), spec->title))
+			++directory_ver;
+	});
+	db().specialties.on_del([this](const auto& spec) {
+		specialities.erase(spec->id());
+		++directory_ver;
+	});
+
+	db().clinics.on_commit([this](const auto&) {
+		clinics_geo.rebuild();
+	});
+	db().clinics.on_update([this](const auto& clinic) {
+		clinics_geo.update(*clinic);
+	});
+	db().clinics.on_del([this](const auto&) {
+		clinics_geo.rebuild();
+	});
+
+	db().doctors.on_commit([this](const auto& doc) {
+		doctors.insert(doc->id(), doc->full_name);
+		doctors_by_spec.insert(*doc);
+		++directory_ver;
+	});
+	db().doctors.on_update([this](const auto& doc) {
+		bool renamed = doctors.insert(doc->id(), doc->full_name);
+		bool moved = doctors_by_spec.insert(*doc);
+		if (renamed || moved)
+			++directory_ver;
+	});
+	db().doctors.on_del([this](const auto& doc) {
+		doctors.erase(doc->id());
+		doctors_by_spec.erase(doc->id());
+		++directory_ver;
+	});
+}
+
+Indexes& Indexes::get_instance()
+{
+	if (instance == nullptr)
+		throw std::runtime_error("Indexes::get_instance(): no instance");
+	return *instance;
+}
+
+Indexes* Indexes::instance = nullptr;
@@ -1,12 +1,66 @@
 #include "bot/logic.h"
+#include "bot/calendar.h"
 #include "bot/database.h"
+#include "bot/indexes.h"
 #include "bot/models.h"
+#include "bot/pool.h"
 #include "bot/tools.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <ctime>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <stdexcept>
 #include <tgbot/types/User.h>
 
+static std::atomic<uint64_t> avail_ver {1};
+
+struct SlotHold
+{
+	id_t chat;
+	Period time;
+	time_t expires;
+};
+
+// записи и удержания врача меняются только под локом его полосы
+struct DoctorStripe
+{
+	std::mutex mtx;
+	std::unordered_map<id_t, std::vector<SlotHold>> holds;
+	// растет при каждой смене удержаний врача
+	std::unordered_map<id_t, uint64_t> holds_ver;
+};
+
+static std::array<DoctorStripe, 64> stripes;
+
+// сама таблица записей общая для всех врачей
+static std::mutex appointments_mtx;
+
+static inline DoctorStripe& stripe(id_t doctor)
+{
+	return stripes[doctor % stripes.size()];
+}
+
+// под локом полосы
+template<typename F>
+static void drop_holds(DoctorStripe& st, id_t doctor, F pred)
+{
+	auto& holds = st.holds[doctor];
+	auto itr = std::remove_if(holds.begin(), holds.end(), pred);
+	if (itr == holds.end())
+		return;
+	holds.erase(itr, holds.end());
+	++st.holds_ver[doctor];
+}
+
+static void drop_expired_holds(DoctorStripe& st, id_t doctor, time_t now)
+{
+	drop_holds(st, doctor, [now](const auto& h){ return h.expires <= now; });
+}
+
 static inline DB1& db()
 {
 	return DB1::get_instance();
@@ -60,6 +114,31 @@ std::shared_ptr<const Speciality> get_speciality(id_t id)
 	return db().specialties.get(id);
 }
 
+// однозначно, только если лучшее совпадение строго лучше второго: у тезок
+// одинаковый счет, и выбирать между ними должен пользователь
+template<typename T>
+static std::vector<std::shared_ptr<const T>> find_in(const TextIndex& index,
+	Table<T>& table, const std::string& text, size_t limit, bool* unique)
+{
+	auto hits = index.search(text, limit);
+	if (unique)
+		*unique = hits.size() == 1 ||
+			(hits.size() > 1 && hits[0].score < hits[1].score);
+
+	std::vector<std::shared_ptr<const T>> res;
+	res.reserve(hits.size());
+	for (const auto& h : hits)
+		res.push_back(table.get(h.id));
+	return res;
+}
+
+std::vector<std::shared_ptr<const Speciality>> find_specialities(
+	const std::string& text, size_t limit, bool* unique)
+{
+	return find_in(Indexes::get_instance().specialities, db().specialties,
+		text, limit, unique);
+}
+
 std::shared_ptr<const Clinic> get_clinic(const std::string& address)
 {
 	return db().clinics.find(
@@ -71,6 +150,20 @@ std::shared_ptr<const Clinic> get_clinic(id_t id)
 	return db().clinics.get(id);
 }
 
+std::vector<std::pair<double, id_t>> nearest_clinics(double lat, double lon,
+	size_t k, id_t spec, time_t from)
+{
+	time_t first = day_start(from);
+	time_t last = add_days(first, 30);
+	return Indexes::get_instance().clinics_geo.nearest(lat, lon, k,
+		[spec, first, last](id_t clinic) {
+			for (time_t day = first; day <= last; day = add_days(day, 1))
+				if (free_slots_in_day(spec, clinic, day))
+					return true;
+			return false;
+		});
+}
+
 Chat::Tmp& get_tmp_appo(id_t chat)
 {
 	return db().chats.get(chat)->tmp;
@@ -81,105 +174,352 @@ std::shared_ptr<const Doctor> get_doctor(id_t id)
 	return db().doctors.get(id);
 }
 
-std::vector<std::shared_ptr<const Doctor>> get_doctors(id_t spec, id_t clinic)
+bool has_doctor(id_t id)
 {
-	auto docs = db().doctors.filter([spec, clinic](auto d){
-		if (spec) {
-			if (clinic)
-				return d->specialities.has(spec) && d->clinic.id() == clinic;
-			return d->specialities.has(spec);
-		} else {
-			if (clinic)
-				return d->clinic.id() == clinic;
-			return true;
-		}
-	});
-	
-	std::vector<std::shared_ptr<const Doctor>> res(docs.size());
-	for (size_t i = 0; i < docs.size(); ++i)
-		res[i] = docs[i];
-	return res;
+	return db().doctors.has(id);
 }
 
-std::vector<time_t> all_available_in_day(id_t doctor,
-	id_t speciality, time_t day)
+std::shared_ptr<const Appointment> get_appointment(id_t id)
 {
-	struct tm t = *std::localtime(&day);
-	if (t.tm_hour || t.tm_min || t.tm_sec)
-		throw std::runtime_error("all_available_in_day: zrada");
+	if (!db().appointments.has(id))
+		return nullptr;
+	return db().appointments.get(id);
+}
 
-	auto doc = db().doctors.get(doctor);
-	auto spec = db().specialties.get(speciality);
-	auto ws = doc->work_sch.get();
-	
-	if (ws->ws.find(day) == ws->ws.end())
-		return {};
+std::shared_ptr<const std::vector<id_t>> get_doctors(id_t spec, id_t clinic)
+{
+	return Indexes::get_instance().doctors_by_spec.get(spec, clinic);
+}
 
-	const auto& shift = ws->ws[day].work_time;
-	std::vector<time_t> all;
+std::vector<std::shared_ptr<const Doctor>> find_doctors(
+	const std::string& text, size_t limit, bool* unique)
+{
+	return find_in(Indexes::get_instance().doctors, db().doctors,
+		text, limit, unique);
+}
+
+static std::vector<time_t> days_between(time_t from, time_t to)
+{
+	std::vector<time_t> days;
+	for (time_t day = day_start(from); day <= to; day = add_days(day, 1))
+		days.push_back(day);
+	return days;
+}
+
+static bool held_by_other(id_t doctor, const Period& p)
+{
+	auto& st = stripe(doctor);
+	std::lock_guard<std::mutex> lock(st.mtx);
+	auto holds = st.holds.find(doctor);
+	if (holds == st.holds.end())
+		return false;
 
-	for (const auto& p : shift) {
-		for (time_t curr = p.from; curr < p.to; curr += spec->appointment_duration)
-			all.push_back(day + curr);
+	time_t now = time(0);
+	for (const auto& h : holds->second) {
+		if (h.expires > now && h.time.overlap(p))
+			return true;
 	}
+	return false;
+}
 
-	size_t res_len = all.size();
-	for (id_t appo_id : doc->appointments) {
-		auto appo = db().appointments.get(appo_id);
-		for (auto& t : all) {
-			Period p;
-			p.from = t;
-			p.to = p.from + spec->appointment_duration - 1;
+static std::shared_ptr<const WorkSchedule> schedule_of(id_t doctor)
+{
+	auto doc = get_doctor(doctor);
+	return doc->work_sch.is_null() ? nullptr : doc->work_sch.get();
+}
+
+FreeSlots::FreeSlots(id_t doctor, id_t speciality, time_t from, time_t to,
+	bool skip_held)
+:doc{doctor}, ws{schedule_of(doctor)},
+dur{db().specialties.get(speciality)->appointment_duration},
+from{from}, to{to}, skip_held{skip_held}, day{day_start(from)},
+shift{nullptr}, period{0}, t{0}
+{}
 
-			if (appo->time.overlap(p)) {
-				t = 0;
-				--res_len;
+time_t FreeSlots::next()
+{
+	const auto& busy = Indexes::get_instance().doctor_appointments;
+	for (;;) {
+		if (shift == nullptr && !enter_day())
+			return 0;
+
+		for (; period < shift->size(); ++period, t = 0) {
+			const auto& p = (*shift)[period];
+			if (t == 0)
+				t = day + p.from;
+			for (; t < day + p.to; t += dur) {
+				if (t < from)
+					continue;
+
+				Period slot;
+				slot.from = t;
+				slot.to = t + dur - 1;
+				if (busy.overlaps(doc, slot) ||
+						(skip_held && held_by_other(doc, slot)))
+					continue;
+
+				t += dur;
+				return slot.from;
 			}
 		}
+
+		shift = nullptr;
+		day = add_days(day, 1);
 	}
+}
+
+time_t FreeSlots::position() const
+{
+	if (shift == nullptr)
+		return std::max(from, day);
+	if (period == shift->size())
+		return std::max(from, add_days(day, 1));
+	return std::max(from, t ? t : day + (*shift)[period].from);
+}
 
-	std::vector<time_t> res(res_len);
-	size_t i = 0;
-	for (size_t j = 0; j < all.size(); ++j) {
-		if (all[j])
-			res[i++] = all[j];
+bool FreeSlots::enter_day()
+{
+	if (ws == nullptr)
+		return false;
+
+	for (; day <= to; day = add_days(day, 1)) {
+		auto itr = ws->ws.find(day);
+		if (itr != ws->ws.end()) {
+			shift = &itr->second.work_time;
+			period = 0;
+			t = 0;
+			return true;
+		}
 	}
+	return false;
+}
 
-	return res;
+FreeSlots::iterator::iterator(FreeSlots* slots)
+:slots{slots}, curr{slots ? slots->next() : 0}
+{}
+
+time_t FreeSlots::iterator::operator*() const
+{
+	return curr;
+}
+
+FreeSlots::iterator& FreeSlots::iterator::operator++()
+{
+	curr = slots->next();
+	return *this;
+}
+
+bool FreeSlots::iterator::operator!=(const iterator& i) const
+{
+	return curr != i.curr;
+}
+
+FreeSlots::iterator FreeSlots::begin()
+{
+	return iterator(this);
 }
 
-time_t nearest_available_in_day(id_t doctor, id_t speciality, time_t day)
+FreeSlots::iterator FreeSlots::end()
 {
-	auto vec = all_available_in_day(doctor, speciality, day);
-	if (vec.size())
-		return vec[0];
-	return 0;
+	return iterator();
 }
 
 time_t nearest_available(id_t doctor, id_t speciality, time_t from, time_t to)
 {
-	struct tm from_tm;
 	if (from == 0)
 		from = time(0);
-	from_tm = *std::localtime(&from);
-	from_tm.tm_hour = from_tm.tm_min = from_tm.tm_sec = 0;
+	if (to == 0)
+		to = time(0) + 30*24*3600;
+
+	return FreeSlots(doctor, speciality, from, to).next();
+}
+
+std::vector<SlotOffer> earliest_available(id_t spec, id_t clinic, size_t k,
+	time_t from, time_t to)
+{
+	time_t now = time(0);
+	if (from < now)
+		from = now;
+	if (to == 0)
+		to = now + 30*24*3600;
+
+	// дни, где по индексу свободных слотов нет ни у кого, пропускаем сразу
+	time_t day = day_start(from);
+	while (day <= to && !free_slots_in_day(spec, clinic, day))
+		day = add_days(day, 1);
+	if (day > to)
+		return {};
+	if (day > from)
+		from = day;
+
+	auto list = get_doctors(spec, clinic);
+	const auto& docs = *list;
+	std::vector<FreeSlots> streams;
+	streams.reserve(docs.size());
+
+	using item = std::pair<time_t, size_t>;
+	std::priority_queue<item, std::vector<item>, std::greater<item>> heap;
+	for (id_t doc : docs) {
+		streams.emplace_back(doc, spec, from, to);
+		time_t t = streams.back().next();
+		if (t)
+			heap.push({t, streams.size() - 1});
+	}
 
-	struct tm to_tm;
+	std::vector<SlotOffer> res;
+	while (res.size() < k && !heap.empty()) {
+		auto [t, i] = heap.top();
+		heap.pop();
+		res.push_back({t, docs[i]});
+		time_t next = streams[i].next();
+		if (next)
+			heap.push({next, i});
+	}
+	return res;
+}
+
+size_t Availability::count(size_t doc, size_t day) const
+{
+	size_t i = doc * days.size() + day;
+	return offsets[i + 1] - offsets[i];
+}
+
+const time_t* Availability::begin(size_t doc, size_t day) const
+{
+	return slots.data() + offsets[doc * days.size() + day];
+}
+
+const time_t* Availability::end(size_t doc, size_t day) const
+{
+	return slots.data() + offsets[doc * days.size() + day + 1];
+}
+
+time_t Availability::nearest(size_t doc) const
+{
+	size_t i = doc * days.size();
+	size_t j = i + days.size();
+	return offsets[i] == offsets[j] ? 0 : slots[offsets[i]];
+}
+
+Availability availability(id_t spec, id_t clinic, time_t from, time_t to,
+	std::chrono::milliseconds budget, bool skip_held)
+{
+	if (from == 0)
+		from = time(0);
 	if (to == 0)
 		to = time(0) + 30*24*3600;
-	to_tm = *std::localtime(&from);
-	to_tm.tm_hour = to_tm.tm_min = to_tm.tm_sec = 0;
 
-	struct tm curr_tm = from_tm;
-	for (;;) {
-		time_t day = std::mktime(&curr_tm);
-		time_t res = nearest_available_in_day(doctor, speciality, day);
-		if (res)
-			return res;
-		++curr_tm.tm_mday;
-		if (day > to)
-			return 0;
+	auto deadline = budget.count() > 0 ?
+		std::chrono::steady_clock::now() + budget :
+		std::chrono::steady_clock::time_point::max();
+
+	Availability res;
+	res.doctors = *get_doctors(spec, clinic);
+	res.days = days_between(from, to);
+	res.complete = true;
+
+	size_t n_days = res.days.size();
+	std::vector<uint32_t> counts(res.doctors.size() * n_days);
+	std::vector<std::vector<time_t>> rows(res.doctors.size());
+	std::vector<char> done(res.doctors.size());
+
+	// строки врачей независимы, считаем их параллельно
+	auto& pool = ThreadPool::get_instance();
+	size_t workers = std::min(pool.size(), res.doctors.size());
+	std::vector<std::future<void>> tasks;
+	tasks.reserve(workers);
+	for (size_t w = 0; w < workers; ++w) {
+		tasks.push_back(pool.submit([&, w]() {
+			for (size_t i = w; i < res.doctors.size(); i += workers) {
+				if (std::chrono::steady_clock::now() > deadline)
+					return;
+				uint32_t* cnt = counts.data() + i * n_days;
+				size_t d = 0;
+				FreeSlots slots(res.doctors[i], spec, from, to, skip_held);
+				for (time_t slot : slots) {
+					while (d + 1 < n_days && slot >= res.days[d + 1])
+						++d;
+					rows[i].push_back(slot);
+					++cnt[d];
+				}
+				done[i] = true;
+			}
+		}));
+	}
+
+	// таски ссылаются на локальные переменные, поэтому сначала ждем всех
+	for (auto& f : tasks)
+		f.wait();
+	for (auto& f : tasks)
+		f.get();
+
+	res.offsets.resize(counts.size() + 1);
+	for (size_t i = 0; i < counts.size(); ++i)
+		res.offsets[i + 1] = res.offsets[i] + counts[i];
+
+	res.slots.reserve(res.offsets.back());
+	for (size_t i = 0; i < res.doctors.size(); ++i) {
+		if (!done[i])
+			res.complete = false;
+		res.slots.insert(res.slots.end(), rows[i].begin(), rows[i].end());
+	}
+
+	return res;
+}
+
+std::vector<InlineHit> inline_search(const std::string& text, size_t limit,
+	std::chrono::milliseconds budget)
+{
+	auto deadline = std::chrono::steady_clock::now() + budget;
+	auto in_budget = [&deadline]() {
+		return std::chrono::steady_clock::now() < deadline;
+	};
+
+	std::vector<InlineHit> res;
+	res.reserve(limit);
+	const auto& index = Indexes::get_instance();
+	for (const auto& h : index.specialities.search(text, limit)) {
+		bool checked = in_budget();
+		time_t nearest = 0;
+		if (checked) {
+			auto offers = earliest_available(h.id);
+			if (!offers.empty())
+				nearest = offers[0].time;
+		}
+		res.push_back({InlineHit::Kind::Speciality, h.id, h.id, checked, nearest});
+	}
+
+	for (const auto& h : index.doctors.search(text, limit - res.size())) {
+		auto doc = db().doctors.get(h.id);
+		if (doc->specialities.size() == 0)
+			continue;
+		id_t spec = *std::min_element(doc->specialities.begin(),
+			doc->specialities.end());
+		bool checked = in_budget();
+		time_t nearest = checked ? nearest_available(h.id, spec) : 0;
+		res.push_back({InlineHit::Kind::Doctor, h.id, spec, checked, nearest});
 	}
+	return res;
+}
+
+uint64_t availability_version()
+{
+	return avail_ver;
+}
+
+void availability_changed()
+{
+	++avail_ver;
+}
+
+uint64_t directory_version()
+{
+	return Indexes::get_instance().directory_ver;
+}
+
+int free_slots_in_day(id_t spec, id_t clinic, time_t day)
+{
+	return Indexes::get_instance().free_slots.free_slots(spec, clinic, day);
 }
 
 void create_client(const std::string& full_name, const std::string& email,
@@ -200,6 +540,7 @@ void make_appointment(id_t client, id_t doctor, id_t speciality,
 		clinic = db().doctors.get(doctor)->clinic->id();
 	auto appo = Ptr<Appointment>(client, doctor, speciality, p, clinic);
 	appo->resolve_relations();
+	++avail_ver;
 
 	log(time_to_hh_mm_ss(std::time(0)), "add",
 		db().clients.get(client)->user->user_name, spec->title);
@@ -211,17 +552,197 @@ void cancel_appointment(id_t appointment)
 	log(time_to_hh_mm_ss(time(0)), "del",
 		appo->client->user->user_name, appo->speciality->title);
 
+	std::lock_guard<std::mutex> lock(stripe(appo->doctor.id()).mtx);
+	std::lock_guard<std::mutex> table_lock(appointments_mtx);
 	db().appointments.del(appointment);
+	++avail_ver;
+}
+
+AppointmentsPage get_client_appointments(id_t client, size_t offset,
+	size_t n, time_t since)
+{
+	const auto& index = Indexes::get_instance().client_appointments;
+
+	AppointmentsPage res;
+	res.total = index.count_from(client, since);
+	for (const auto& e : index.window(client, since, offset, n))
+		res.items.push_back(db().appointments.get(e.id));
+	return res;
+}
+
+size_t export_roster(id_t clinic, time_t day, std::ostream& out)
+{
+	size_t n = 0;
+	Indexes::get_instance().clinic_day.for_each({clinic, day_start(day)},
+		[&out, &n](const auto& e) {
+			auto appo = db().appointments.get(e.id);
+			out << time_to_hh_mm(e.from) << '\t'
+				<< (appo->doctor.is_null() ? "" : appo->doctor->full_name) << '\t'
+				<< (appo->speciality.is_null() ? "" : appo->speciality->title) << '\t';
+			if (appo->client.is_null())
+				out << "\t\n";
+			else
+				out << appo->client->full_name << '\t'
+					<< appo->client->phone_number << '\n';
+			++n;
+		});
+	return n;
+}
+
+// время - начало одного из слотов смены врача
+static bool in_schedule(id_t doctor, id_t speciality, time_t time)
+{
+	auto doc = get_doctor(doctor);
+	if (doc->work_sch.is_null())
+		return false;
+
+	time_t day = day_start(time);
+	auto ws = doc->work_sch.get();
+	auto shift = ws->ws.find(day);
+	if (shift == ws->ws.end())
+		return false;
+
+	time_t dur = db().specialties.get(speciality)->appointment_duration;
+	for (const auto& p : shift->second.work_time) {
+		if (time >= day + p.from && time < day + p.to &&
+				(time - day - p.from) % dur == 0)
+			return true;
+	}
+	return false;
+}
+
+bool try_book(id_t client, id_t doctor, id_t speciality, time_t time,
+	id_t clinic, id_t chat)
+{
+	Period p;
+	p.from = time;
+	p.to = p.from + db().specialties.get(speciality)->appointment_duration - 1;
+
+	auto& st = stripe(doctor);
+	std::lock_guard<std::mutex> lock(st.mtx);
+
+	drop_expired_holds(st, doctor, std::time(0));
+	for (const auto& h : st.holds[doctor]) {
+		if (h.chat != chat && h.time.overlap(p))
+			return false;
+	}
+
+	if (appointment_exist(doctor, speciality, time) ||
+			!in_schedule(doctor, speciality, time))
+		return false;
+
+	{
+		std::lock_guard<std::mutex> table_lock(appointments_mtx);
+		make_appointment(client, doctor, speciality, time, clinic);
+	}
+
+	drop_holds(st, doctor, [chat](const auto& h){ return h.chat == chat; });
+	return true;
+}
+
+bool hold_slot(id_t chat, id_t doctor, id_t speciality, time_t time,
+	time_t ttl)
+{
+	Period p;
+	p.from = time;
+	p.to = p.from + db().specialties.get(speciality)->appointment_duration - 1;
+
+	auto& st = stripe(doctor);
+	std::lock_guard<std::mutex> lock(st.mtx);
+
+	time_t now = std::time(0);
+	drop_expired_holds(st, doctor, now);
+	for (const auto& h : st.holds[doctor]) {
+		if (h.chat != chat && h.time.overlap(p))
+			return false;
+	}
+
+	if (appointment_exist(doctor, speciality, time) ||
+			!in_schedule(doctor, speciality, time))
+		return false;
+
+	drop_holds(st, doctor, [chat](const auto& h){ return h.chat == chat; });
+	st.holds[doctor].push_back({chat, p, now + ttl});
+	++st.holds_ver[doctor];
+	return true;
+}
+
+void release_hold(id_t chat, id_t doctor)
+{
+	auto& st = stripe(doctor);
+	std::lock_guard<std::mutex> lock(st.mtx);
+
+	if (st.holds.find(doctor) == st.holds.end())
+		return;
+	drop_holds(st, doctor, [chat](const auto& h){ return h.chat == chat; });
+}
+
+void expire_holds()
+{
+	time_t now = std::time(0);
+	for (auto& st : stripes) {
+		std::lock_guard<std::mutex> lock(st.mtx);
+		for (auto itr = st.holds.begin(); itr != st.holds.end();) {
+			drop_expired_holds(st, itr->first, now);
+			// версия остается: по ней сверяются кэши страниц
+			if (itr->second.empty())
+				itr = st.holds.erase(itr);
+			else
+				++itr;
+		}
+	}
 }
 
-std::vector<std::shared_ptr<const Appointment>> get_client_appointments(
-	id_t client)
+uint64_t holds_version(id_t doctor)
 {
-	auto c = db().clients.get(client);
-	std::vector<std::shared_ptr<const Appointment>> res(c->appointments.size());
-	size_t i = 0;
-	for (id_t appo_id : c->appointments)
-		res[i++] = db().appointments.get(appo_id);
+	auto& st = stripe(doctor);
+	std::lock_guard<std::mutex> lock(st.mtx);
+	auto itr = st.holds_ver.find(doctor);
+	return itr == st.holds_ver.end() ? 0 : itr->second;
+}
+
+void join_waitlist(id_t chat, id_t speciality, id_t clinic,
+	time_t from, time_t to)
+{
+	time_t today = day_start(std::time(0));
+	Period dates;
+	dates.from = std::max(from ? day_start(from) : today, today);
+	dates.to = to ? day_start(to) : add_days(dates.from, 30);
+	if (dates.to < dates.from)
+		return;
+	Ptr<WaitlistEntry>(chat, speciality, clinic, dates);
+}
+
+std::vector<WaitlistOffer> take_waitlist_offers(time_t ttl)
+{
+	auto& index = Indexes::get_instance().waitlist;
+	std::vector<WaitlistOffer> res;
+	time_t now = std::time(0);
+	// истекшие заявки уже ничего не получат
+	for (id_t e : index.expired(day_start(now)))
+		db().waitlist.del(e);
+
+	for (const auto& slot : index.take_freed()) {
+		if (slot.time.from < now)
+			continue;
+
+		id_t entry_id = index.match(slot.spec, slot.clinic, slot.time.from);
+		if (!entry_id)
+			continue;
+
+		auto entry = db().waitlist.get(entry_id);
+		id_t chat = entry->chat.id();
+		if (!db().chats.has(chat)) {
+			db().waitlist.del(entry_id);
+			continue;
+		}
+		if (!hold_slot(chat, slot.doctor, slot.spec, slot.time.from, ttl))
+			continue;
+
+		db().waitlist.del(entry_id);
+		res.push_back({db().chats.get(chat)->chat_id, chat, slot.doctor,
+			slot.spec, slot.time.from});
+	}
 	return res;
 }
 
@@ -230,12 +751,165 @@ bool appointment_exist(id_t doctor, id_t speciality, time_t time)
 	Period p;
 	p.from = time;
 	p.to = p.from + db().specialties.get(speciality)->appointment_duration - 1;
-	for (id_t a : get_doctor(doctor)->appointments) {
-		const auto& appo = db().appointments.get(a);
-		if (appo->time.overlap(p))
-			return true;
+	return Indexes::get_instance().doctor_appointments.overlaps(doctor, p);
+}
+
+// промежутки смены old, которых нет в now, в абсолютном времени
+static void subtract_shift(time_t day, const std::vector<Period>& old,
+	const std::vector<Period>& now, std::vector<Period>& out)
+{
+	for (const auto& o : old) {
+		time_t curr = o.from;
+		for (const auto& n : now) {
+			if (n.to <= curr || n.from >= o.to)
+				continue;
+			if (n.from > curr) {
+				Period p;
+				p.from = day + curr;
+				p.to = day + n.from;
+				out.push_back(p);
+			}
+			curr = std::max(curr, n.to);
+		}
+		if (curr < o.to) {
+			Period p;
+			p.from = day + curr;
+			p.to = day + o.to;
+			out.push_back(p);
+		}
 	}
-	return false;
+}
+
+static bool same_shift(const WorkShift& s1, const WorkShift& s2)
+{
+	return std::equal(s1.work_time.begin(), s1.work_time.end(),
+		s2.work_time.begin(), s2.work_time.end(),
+		[](const auto& p1, const auto& p2) {
+			return p1.from == p2.from && p1.to == p2.to;
+		});
+}
+
+size_t change_work_schedule(id_t schedule,
+	const std::unordered_map<time_t, WorkShift>& ws)
+{
+	auto sch = db().work_shedule.get(schedule);
+
+	// обходятся только дни расписаний, записи - только из убранных промежутков
+	std::vector<time_t> days;
+	std::vector<Period> removed;
+	for (const auto& kv : sch->ws) {
+		auto itr = ws.find(kv.first);
+		if (itr == ws.end()) {
+			days.push_back(kv.first);
+			subtract_shift(kv.first, kv.second.work_time, {}, removed);
+		} else if (!same_shift(kv.second, itr->second)) {
+			days.push_back(kv.first);
+			subtract_shift(kv.first, kv.second.work_time,
+				itr->second.work_time, removed);
+		}
+	}
+	for (const auto& kv : ws) {
+		if (sch->ws.find(kv.first) == sch->ws.end())
+			days.push_back(kv.first);
+	}
+
+	std::vector<id_t> doctors(sch->doctors.begin(), sch->doctors.end());
+	std::vector<size_t> locked;
+	for (id_t doc : doctors)
+		locked.push_back(&stripe(doc) - stripes.data());
+	std::sort(locked.begin(), locked.end());
+	locked.erase(std::unique(locked.begin(), locked.end()), locked.end());
+	std::vector<std::unique_lock<std::mutex>> locks;
+	for (size_t i : locked)
+		locks.emplace_back(stripes[i].mtx);
+	std::lock_guard<std::mutex> table_lock(appointments_mtx);
+
+	auto& index = Indexes::get_instance();
+	time_t now = std::time(0);
+	std::vector<id_t> cancelled;
+	for (id_t doc : doctors) {
+		for (const auto& p : removed) {
+			if (p.to <= now)
+				continue;
+			// убранные промежутки полуоткрыты, записи - замкнуты
+			Period q;
+			q.from = std::max(p.from, now);
+			q.to = p.to - 1;
+			index.doctor_appointments.for_overlap(doc, q,
+				[&cancelled, now](const auto& e) {
+					if (e.from >= now)
+						cancelled.push_back(e.id);
+				});
+		}
+	}
+	// запись может задеть несколько убранных промежутков
+	std::sort(cancelled.begin(), cancelled.end());
+	cancelled.erase(std::unique(cancelled.begin(), cancelled.end()),
+		cancelled.end());
+
+	for (id_t id : cancelled) {
+		auto appo = db().appointments.get(id);
+		if (!appo->client.is_null() && !appo->client->user.is_null() &&
+				!appo->client->user->chat.is_null() &&
+				!appo->speciality.is_null()) {
+			// уведомление хранится в базе и переживет перезапуск
+			Ptr<PendingNotice>(appo->client->user->chat.id(), appo->doctor.id(),
+				appo->speciality.id(), appo->clinic.id(), appo->time.from);
+		}
+		// слот освобождается по старому расписанию и сразу уходит с ним
+		db().appointments.del(id);
+	}
+
+	for (id_t doc : doctors)
+		for (time_t day : days)
+			index.free_slots.on_schedule(*get_doctor(doc), day, -1);
+	sch->ws = ws;
+	db().work_shedule.touch(schedule);
+	for (id_t doc : doctors)
+		for (time_t day : days)
+			index.free_slots.on_schedule(*get_doctor(doc), day, 1);
+	++avail_ver;
+
+	log(time_to_hh_mm_ss(now), "schedule", schedule, days.size(),
+		cancelled.size());
+	return cancelled.size();
+}
+
+size_t pending_schedule_notices()
+{
+	return db().notices.size();
+}
+
+std::vector<ScheduleNotice> take_schedule_notices(size_t n, time_t ttl)
+{
+	// идентификаторы растут, меньшие - поставленные раньше
+	auto all = db().notices.all();
+	n = std::min(n, all.size());
+	std::partial_sort(all.begin(), all.begin() + n, all.end(),
+		[](const auto& a, const auto& b) { return a->id() < b->id(); });
+
+	std::vector<ScheduleNotice> res;
+	for (size_t i = 0; i < n; ++i) {
+		auto entry = all[i];
+		db().notices.del(entry->id());
+		// чат могли удалить, пока уведомление ждало очереди
+		if (!db().chats.has(entry->chat))
+			continue;
+		res.push_back({db().chats.get(entry->chat)->chat_id, entry->chat,
+			entry->doctor, entry->speciality, entry->clinic, entry->time, 0});
+	}
+
+	time_t now = std::time(0);
+	for (auto& notice : res) {
+		if (!db().doctors.has(notice.doctor) ||
+				!db().specialties.has(notice.spec))
+			continue;
+		time_t t = nearest_available(notice.doctor, notice.spec,
+			std::max(notice.time, now));
+		if (t && hold_slot(notice.chat, notice.doctor, notice.spec, t, ttl))
+			notice.offer = t;
+	}
+	return res;
 }
 
 std::vector<std::shared_ptr<const Speciality>> get_all_specialities()
@@ -246,6 +920,22 @@ std::vector<std::shared_ptr<const Speciality>> get_all_specialities()
 	return res;
 }
 
+std::vector<std::shared_ptr<const Chat>> get_all_chats()
+{
+	std::vector<std::shared_ptr<const Chat>> res;
+	for (auto ptr : db().chats.all())
+		res.push_back(ptr);
+	return res;
+}
+
+std::vector<std::shared_ptr<const Clinic>> get_all_clinics()
+{
+	std::vector<std::shared_ptr<const Clinic>> res;
+	for (auto ptr : db().clinics.all())
+		res.push_back(ptr);
+	return res;
+}
+
 
 
 // временно
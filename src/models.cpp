@@ -292,7 +292,7 @@ void Speciality::deserialize(const rapidjson::Value& obj)
 }
 
 Clinic::Clinic(const std::string& address)
-:address{address},
+:address{address}, located{false}, lat{0}, lon{0},
 appointments{Relation::BackToMany, id(), {}, OnDelete::Restrict},
 doctors{Relation::BackToMany, id(), {}, OnDelete::Restrict}
 {}
@@ -307,6 +307,10 @@ rapidjson::Value Clinic::serialize(
 {
 	auto obj = Model::serialize(alloc);
 	add_str(obj, alloc, "addr", address);
+	if (located) {
+		add_prop(obj, alloc, "lat", lat);
+		add_prop(obj, alloc, "lon", lon);
+	}
 	return obj;
 }
 
@@ -314,6 +318,9 @@ void Clinic::deserialize(const rapidjson::Value& obj)
 {
 	Model::deserialize(obj);
 	address = obj["addr"].GetString();
+	located = obj.HasMember("lat") && obj.HasMember("lon");
+	lat = located ? obj["lat"].GetDouble() : 0;
+	lon = located ? obj["lon"].GetDouble() : 0;
 	doctors = ForeignKey<Clinic, Doctor>(
 		Relation::BackToMany, id(), {}, OnDelete::Restrict);
 	appointments = ForeignKey<Clinic, Appointment>(
@@ -345,4 +352,68 @@ void WorkSchedule::deserialize(const rapidjson::Value& obj)
 	doctors = ForeignKey<WorkSchedule, Doctor>(
 		Relation::BackToMany, id(), {}, OnDelete::Restrict);
 	ws = deserialize_u_map<WorkShift>(obj["ws"]);
-}
\ No newline at end of file
+}
+
+WaitlistEntry::WaitlistEntry(id_t chat, id_t speciality, id_t clinic,
+	Period dates)
+:chat{Relation::OneToOne, id(), {chat}, OnDelete::NoAction},
+speciality{Relation::OneToOne, id(), {speciality}, OnDelete::NoAction},
+clinic{clinic}, dates{dates}
+{}
+
+WaitlistEntry::WaitlistEntry(const rapidjson::Value& json)
+{
+	deserialize(json);
+}
+
+rapidjson::Value WaitlistEntry::serialize(
+	rapidjson::MemoryPoolAllocator<>& alloc) const
+{
+	auto obj = Model::serialize(alloc);
+	add_prop(obj, alloc, "chat", chat.serialize(alloc));
+	add_prop(obj, alloc, "spec", speciality.serialize(alloc));
+	add_prop(obj, alloc, "clinic", clinic);
+	add_prop(obj, alloc, "dates", dates.serialize(alloc));
+	return obj;
+}
+
+void WaitlistEntry::deserialize(const rapidjson::Value& obj)
+{
+	Model::deserialize(obj);
+	chat.deserialize(obj["chat"]);
+	speciality.deserialize(obj["spec"]);
+	clinic = obj["clinic"].GetInt64();
+	dates.deserialize(obj["dates"]);
+}
+
+PendingNotice::PendingNotice(id_t chat, id_t doctor, id_t speciality,
+	id_t clinic, time_t time)
+:chat{chat}, doctor{doctor}, speciality{speciality}, clinic{clinic}, time{time}
+{}
+
+PendingNotice::PendingNotice(const rapidjson::Value& json)
+{
+	deserialize(json);
+}
+
+rapidjson::Value PendingNotice::serialize(
+	rapidjson::MemoryPoolAllocator<>& alloc) const
+{
+	auto obj = Model::serialize(alloc);
+	add_prop(obj, alloc, "chat", chat);
+	add_prop(obj, alloc, "doctor", doctor);
+	add_prop(obj, alloc, "spec", speciality);
+	add_prop(obj, alloc, "clinic", clinic);
+	add_prop(obj, alloc, "time", (int64_t)time);
+	return obj;
+}
+
+void PendingNotice::deserialize(const rapidjson::Value& obj)
+{
+	Model::deserialize(obj);
+	chat = obj["chat"].GetInt64();
+	doctor = obj["doctor"].GetInt64();
+	speciality = obj["spec"].GetInt64();
+	clinic = obj["clinic"].GetInt64();
+	time = obj["time"].GetInt64();
+}
@@ -0,0 +1,60 @@
+#include "bot/pool.h"
+#include <algorithm>
+#include <stdexcept>
+
+ThreadPool::ThreadPool(size_t workers)
+:stopped{false}
+{
+	if (workers == 0)
+		workers = std::max(1u, std::thread::hardware_concurrency());
+
+	threads.reserve(workers);
+	for (size_t i = 0; i < workers; ++i)
+		threads.emplace_back(&ThreadPool::work, this);
+
+	instance = this;
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopped = true;
+	}
+	cv.notify_all();
+	for (auto& t : threads)
+		t.join();
+
+	if (instance == this)
+		instance = nullptr;
+}
+
+size_t ThreadPool::size() const
+{
+	return threads.size();
+}
+
+ThreadPool& ThreadPool::get_instance()
+{
+	if (instance == nullptr)
+		throw std::runtime_error("ThreadPool::get_instance(): no instance");
+	return *instance;
+}
+
+void ThreadPool::work()
+{
+	for (;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [this](){ return stopped || !tasks.empty(); });
+			if (stopped && tasks.empty())
+				return;
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
+
+ThreadPool* ThreadPool::instance = nullptr;
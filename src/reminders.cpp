@@ -0,0 +1,88 @@
+#include "bot/reminders.h"
+#include "bot/database.h"
+#include <stdexcept>
+
+static inline DB1& db()
+{
+	return DB1::get_instance();
+}
+
+static const time_t tomorrow_before = 24 * 3600;
+static const time_t soon_before = 2 * 3600;
+
+// data таймера - id записи и вид напоминания в младшем бите
+Reminders::Reminders()
+:wheel{60, std::time(0)}
+{
+	time_t now = std::time(0);
+	for (const auto& appo : db().appointments.all())
+		schedule(*appo, now);
+
+	db().appointments.on_commit([this](const auto& appo) {
+		std::lock_guard<std::mutex> lock(mtx);
+		schedule(*appo, std::time(0));
+	});
+	db().appointments.on_del([this](const auto& appo) {
+		std::lock_guard<std::mutex> lock(mtx);
+		cancel(appo->id());
+	});
+
+	instance = this;
+}
+
+std::vector<Reminders::Notice> Reminders::take_due(time_t now)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	std::vector<Notice> res;
+	wheel.advance(now, [this, &res](uint64_t data) {
+		id_t appo = data >> 1;
+		res.push_back({appo, (Kind)(data & 1)});
+
+		auto itr = timers.find(appo);
+		if (itr == timers.end())
+			return;
+		itr->second[data & 1] = 0;
+		if (!itr->second[0] && !itr->second[1])
+			timers.erase(itr);
+	});
+	return res;
+}
+
+void Reminders::schedule(const Appointment& appo, time_t now)
+{
+	cancel(appo.id());
+
+	// записи, о которых уже поздно напоминать, пропускаются
+	const std::pair<time_t, Kind> notices[] {
+		{appo.time.from - tomorrow_before, Kind::Tomorrow},
+		{appo.time.from - soon_before, Kind::Soon}};
+
+	for (const auto& [when, kind] : notices) {
+		if (when <= now)
+			continue;
+		uint64_t data = ((uint64_t)appo.id() << 1) | (uint64_t)kind;
+		timers[appo.id()][(int)kind] = wheel.schedule(when, data);
+	}
+}
+
+void Reminders::cancel(id_t appointment)
+{
+	auto itr = timers.find(appointment);
+	if (itr == timers.end())
+		return;
+
+	for (auto id : itr->second) {
+		if (id)
+			wheel.cancel(id);
+	}
+	timers.erase(itr);
+}
+
+Reminders& Reminders::get_instance()
+{
+	if (instance == nullptr)
+		throw std::runtime_error("Reminders::get_instance(): no instance");
+	return *instance;
+}
+
+Reminders* Reminders::instance = nullptr;
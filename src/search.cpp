@@ -0,0 +1,259 @@
+#include "bot/search.h"
+#include <algorithm>
+
+static char32_t fold_char(char32_t c)
+{
+	if (c >= U'A' && c <= U'Z')
+		return c - U'A' + U'a';
+	if (c >= U'А' && c <= U'Я')
+		return c - U'А' + U'а';
+	if (c == U'Ё' || c == U'ё')
+		return U'е';
+	if ((c >= U'a' && c <= U'z') || (c >= U'а' && c <= U'я') ||
+			(c >= U'0' && c <= U'9'))
+		return c;
+	return U' ';
+}
+
+std::u32string fold(const std::string& text)
+{
+	std::u32string res;
+	res.reserve(text.size());
+	for (size_t i = 0; i < text.size();) {
+		unsigned char c = text[i];
+		char32_t cp;
+		size_t len;
+		if (c < 0x80) {
+			cp = c;
+			len = 1;
+		} else if ((c >> 5) == 0x6) {
+			cp = c & 0x1f;
+			len = 2;
+		} else if ((c >> 4) == 0xe) {
+			cp = c & 0x0f;
+			len = 3;
+		} else if ((c >> 3) == 0x1e) {
+			cp = c & 0x07;
+			len = 4;
+		} else {
+			++i;
+			continue;
+		}
+
+		if (i + len > text.size())
+			break;
+		for (size_t j = 1; j < len; ++j)
+			cp = (cp << 6) | (text[i + j] & 0x3f);
+		i += len;
+		res.push_back(fold_char(cp));
+	}
+	return res;
+}
+
+size_t edit_distance(const std::u32string& a, const std::u32string& b,
+	size_t max)
+{
+	if ((a.size() > b.size() ? a.size() - b.size() : b.size() - a.size()) > max)
+		return max + 1;
+
+	std::vector<size_t> prev(b.size() + 1), cur(b.size() + 1);
+	for (size_t j = 0; j <= b.size(); ++j)
+		prev[j] = j;
+
+	for (size_t i = 1; i <= a.size(); ++i) {
+		cur[0] = i;
+		size_t row_min = cur[0];
+		for (size_t j = 1; j <= b.size(); ++j) {
+			cur[j] = std::min({prev[j] + 1, cur[j - 1] + 1,
+				prev[j - 1] + (a[i - 1] != b[j - 1])});
+			row_min = std::min(row_min, cur[j]);
+		}
+		if (row_min > max)
+			return max + 1;
+		prev.swap(cur);
+	}
+	return std::min(prev[b.size()], max + 1);
+}
+
+std::vector<std::u32string> TextIndex::split(const std::u32string& text)
+{
+	std::vector<std::u32string> res;
+	size_t i = 0;
+	while (i < text.size()) {
+		while (i < text.size() && text[i] == U' ')
+			++i;
+		size_t j = i;
+		while (j < text.size() && text[j] != U' ')
+			++j;
+		if (j > i)
+			res.push_back(text.substr(i, j - i));
+		i = j;
+	}
+	return res;
+}
+
+// слово дополняется пробелами с краев, чтобы начало слова весило больше
+std::vector<uint64_t> TextIndex::trigrams(const std::u32string& word)
+{
+	std::u32string w = U"  " + word + U" ";
+	std::vector<uint64_t> res;
+	for (size_t i = 0; i + 3 <= w.size(); ++i)
+		res.push_back(((uint64_t)w[i] << 42) | ((uint64_t)w[i + 1] << 21) |
+			(uint64_t)w[i + 2]);
+	std::sort(res.begin(), res.end());
+	res.erase(std::unique(res.begin(), res.end()), res.end());
+	return res;
+}
+
+bool TextIndex::insert(id_t id, const std::string& text)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto itr = docs.find(id);
+		if (itr != docs.end() && itr->second.source == text)
+			return false;
+	}
+	erase(id);
+
+	Doc doc;
+	doc.source = text;
+	doc.text = fold(text);
+	doc.words = split(doc.text);
+
+	std::lock_guard<std::mutex> lock(mtx);
+	std::vector<uint64_t> doc_grams;
+	for (const auto& w : doc.words) {
+		Word word {w, id};
+		words.insert(std::upper_bound(words.begin(), words.end(), word), word);
+		auto g = trigrams(w);
+		doc_grams.insert(doc_grams.end(), g.begin(), g.end());
+	}
+	std::sort(doc_grams.begin(), doc_grams.end());
+	doc_grams.erase(std::unique(doc_grams.begin(), doc_grams.end()),
+		doc_grams.end());
+	for (uint64_t g : doc_grams) {
+		auto& ids = grams[g];
+		ids.insert(std::upper_bound(ids.begin(), ids.end(), id), id);
+	}
+	docs[id] = std::move(doc);
+	return true;
+}
+
+void TextIndex::erase(id_t id)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto itr = docs.find(id);
+	if (itr == docs.end())
+		return;
+
+	for (const auto& w : itr->second.words) {
+		auto i = std::lower_bound(words.begin(), words.end(), Word{w, id});
+		if (i != words.end() && i->id == id)
+			words.erase(i);
+
+		for (uint64_t g : trigrams(w)) {
+			auto ids = grams.find(g);
+			if (ids == grams.end())
+				continue;
+			auto j = std::lower_bound(ids->second.begin(), ids->second.end(), id);
+			if (j != ids->second.end() && *j == id)
+				ids->second.erase(j);
+			if (ids->second.empty())
+				grams.erase(ids);
+		}
+	}
+	docs.erase(itr);
+}
+
+// опечатка сверяется и с целым словом, и с его началом той же длины,
+// чтобы "кордиол" находил "кардиолог"
+int TextIndex::fuzzy_score(const Doc& doc, const std::u32string& query,
+	size_t max) const
+{
+	size_t best = edit_distance(query, doc.text, max);
+	for (const auto& w : doc.words) {
+		best = std::min(best, edit_distance(query, w, max));
+		if (w.size() > query.size())
+			best = std::min(best,
+				edit_distance(query, w.substr(0, query.size()), max));
+	}
+	return best > max ? -1 : 2 + (int)best;
+}
+
+std::vector<SearchHit> TextIndex::search(const std::string& text,
+	size_t limit) const
+{
+	auto query = fold(text);
+	auto qwords = split(query);
+	if (qwords.empty() || limit == 0)
+		return {};
+
+	// запрос из нескольких слов сверяется с текстом целиком
+	std::u32string q;
+	for (const auto& w : qwords)
+		q += (q.empty() ? U"" : U" ") + w;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	std::unordered_map<id_t, int> scores;
+	auto better = [&scores](id_t id, int score) {
+		auto itr = scores.find(id);
+		if (itr == scores.end() || score < itr->second)
+			scores[id] = score;
+	};
+
+	// последнее слово еще дописывается и ищется как префикс, остальные
+	// должны совпасть со словами текста целиком; текст, совпавший
+	// целиком, тоже находится здесь
+	const auto& last = qwords.back();
+	auto i = std::lower_bound(words.begin(), words.end(), Word{last, 0});
+	for (; i != words.end() && i->word.compare(0, last.size(), last) == 0; ++i) {
+		const auto& doc = docs.at(i->id);
+		bool all = true;
+		for (size_t k = 0; k + 1 < qwords.size() && all; ++k)
+			all = std::find(doc.words.begin(), doc.words.end(), qwords[k]) !=
+				doc.words.end();
+		if (all)
+			better(i->id, doc.text == q ? 0 : 1);
+	}
+
+	// кандидаты на опечатку: хотя бы треть триграмм запроса
+	size_t max = q.size() <= 3 ? 0 : q.size() <= 6 ? 1 : 2;
+	if (max && scores.size() < limit) {
+		auto qgrams = trigrams(q);
+		std::unordered_map<id_t, size_t> shared;
+		for (uint64_t g : qgrams) {
+			auto ids = grams.find(g);
+			if (ids == grams.end())
+				continue;
+			for (id_t id : ids->second)
+				++shared[id];
+		}
+		for (const auto& kv : shared) {
+			if (kv.second * 3 < qgrams.size() || scores.count(kv.first))
+				continue;
+			int score = fuzzy_score(docs.at(kv.first), q, max);
+			if (score >= 0)
+				better(kv.first, score);
+		}
+	}
+
+	std::vector<SearchHit> res;
+	res.reserve(scores.size());
+	for (const auto& kv : scores)
+		res.push_back({kv.first, kv.second});
+
+	auto less = [this](const SearchHit& a, const SearchHit& b) {
+		if (a.score != b.score)
+			return a.score < b.score;
+		const auto& x = docs.at(a.id).text;
+		const auto& y = docs.at(b.id).text;
+		return x.size() < y.size() || (x.size() == y.size() && x < y);
+	};
+	if (res.size() > limit) {
+		std::partial_sort(res.begin(), res.begin() + limit, res.end(), less);
+		res.resize(limit);
+	} else {
+		std::sort(res.begin(), res.end(), less);
+	}
+	return res;
+}
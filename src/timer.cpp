@@ -0,0 +1,57 @@
+#include "bot/timer.h"
+#include <algorithm>
+
+TimingWheel::TimingWheel(time_t tick, time_t now)
+:tick{tick}, cur{(uint64_t)(now / tick)}, next_id{1}
+{}
+
+TimingWheel::timer_id TimingWheel::schedule(time_t when, uint64_t data)
+{
+	uint64_t expires = std::max<uint64_t>(when / tick, cur + 1);
+	// дальше горизонта верхнего уровня не заглядываем
+	expires = std::min<uint64_t>(expires, cur + (1ull << (bits * levels)) - 1);
+
+	Node node {next_id++, expires, data};
+	insert(node);
+	return node.id;
+}
+
+void TimingWheel::cancel(timer_id id)
+{
+	auto itr = where.find(id);
+	if (itr == where.end())
+		return;
+
+	const auto& loc = itr->second;
+	slots[loc.level][loc.slot].erase(loc.node);
+	where.erase(itr);
+}
+
+size_t TimingWheel::size() const
+{
+	return where.size();
+}
+
+void TimingWheel::insert(const Node& node)
+{
+	int level = 0;
+	while (level < levels - 1 &&
+			(node.expires >> (bits * (level + 1))) !=
+			(cur >> (bits * (level + 1))))
+		++level;
+
+	int slot = (node.expires >> (bits * level)) & mask;
+	auto& list = slots[level][slot];
+	list.push_back(node);
+	where[node.id] = {level, slot, std::prev(list.end())};
+}
+
+// колесо вошло в слот уровня level: его таймеры раскладываются ниже
+void TimingWheel::cascade(int level)
+{
+	auto& slot = slots[level][(cur >> (bits * level)) & mask];
+	std::list<Node> nodes;
+	nodes.swap(slot);
+	for (const auto& node : nodes)
+		insert(node);
+}
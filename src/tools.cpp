@@ -1,4 +1,6 @@
 #include "bot/tools.h"
+#include "bot/calendar.h"
+#include <algorithm>
 #include <ctime>
 #include <iostream>
 #include <pcre.h>
@@ -36,9 +38,12 @@ rapidjson::Value WorkShift::serialize(
 	return serialize_vec(work_time, alloc);
 }
 
+// обход слотов и сравнение смен рассчитывают на промежутки по порядку
 void WorkShift::deserialize(const rapidjson::Value& obj)
 {
 	work_time = deserialize_vec<Period>(obj);
+	std::sort(work_time.begin(), work_time.end(),
+		[](const auto& p1, const auto& p2) { return p1.from < p2.from; });
 }
 
 Enumerated::Enumerated()
@@ -100,6 +105,21 @@ const char* TextManager::lang_code_to_str() const
 
 TextManager* TextManager::instance = nullptr;
 
+Config::Config(const std::string& file_name)
+:doc{read_json(file_name)}
+{
+	instance = this;
+}
+
+Config& Config::get_instance()
+{
+	if (instance == nullptr)
+		throw std::runtime_error("Config::get_instance(): no instance");
+	return *instance;
+}
+
+Config* Config::instance = nullptr;
+
 rapidjson::Document read_json(const std::string& file_path)
 {
 	FILE* fp = std::fopen(file_path.c_str(), "r");
@@ -157,7 +177,7 @@ void add_str(rapidjson::Value& obj, rapidjson::MemoryPoolAllocator<>& alloc,
 
 std::string time_to_dd_month_hh_mm(const TextManager& tm, time_t t)
 {
-	struct tm date = *std::localtime(&t);
+	struct tm date = local_tm(t);
 	return std::to_string(date.tm_mday) + " " +
 		tm.vec("month_genitive_case")[date.tm_mon] + ", " +
 		time_to_hh_mm(t);
@@ -165,7 +185,7 @@ std::string time_to_dd_month_hh_mm(const TextManager& tm, time_t t)
 
 std::string time_to_hh_mm(time_t t)
 {
-	struct tm date = *std::localtime(&t);
+	struct tm date = local_tm(t);
 	std::string res = std::to_string(date.tm_hour) + ":";
 	res += (date.tm_min < 10 ? "0" : "") + std::to_string(date.tm_min);
 	return res;
@@ -173,7 +193,7 @@ std::string time_to_hh_mm(time_t t)
 
 std::string time_to_mm_dd(time_t t)
 {
-	struct tm date = *std::localtime(&t);
+	struct tm date = local_tm(t);
 	std::string res = "";
 	res += (date.tm_mon + 1 < 10 ? "0" : "") + std::to_string(date.tm_mon + 1);
 	res += ".";
@@ -218,7 +238,7 @@ std::string format_appointment(const TextManager& tm, const std::string& spec,
 
 std::string time_to_hh_mm_ss(time_t t)
 {
-	struct tm x = *std::localtime(&t);
+	struct tm x = local_tm(t);
 	std::string res;
 	res += (x.tm_hour < 10 ? "0" : "") + std::to_string(x.tm_hour) + ":";
 	res += (x.tm_min < 10 ? "0" : "") + std::to_string(x.tm_min) + ":";
@@ -0,0 +1,516 @@
+// Массовый импорт специальностей, клиник, расписаний и врачей из CSV/TSV
+// в снимок базы (формат data/db.json). Собирается отдельно: make import
+//
+//   tg_import <db.json> <out.json> [--specialties файл] [--clinics файл]
+//       [--schedules файл] [--doctors файл]
+//
+// Первая строка файла - заголовок с именами колонок, разделитель - запятая
+// для .csv, иначе табуляция. key - ключ строки внутри импорта; ссылка - это
+// ключ из импорта или #id объекта, который уже есть в снимке:
+//   specialties: key, title, dur (минуты)
+//   clinics: key, addr[, lat, lon]
+//   schedules: key, date (ГГГГ-ММ-ДД), from, to (ЧЧ:ММ) - строка на промежуток
+//   doctors: key, full_name, phone_number, email, photo, desc,
+//       spec (ссылки через ;), ws, clinic
+#include "bot/calendar.h"
+#include "bot/storage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <rapidjson/document.h>
+#include <rapidjson/filereadstream.h>
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/writer.h>
+
+using Alloc = rapidjson::MemoryPoolAllocator<>;
+
+class TableReader
+{
+public:
+	TableReader(const std::string& file)
+	:file{file}, line_no{0}
+	{
+		in.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+		in.open(file);
+		if (!in.is_open())
+			throw std::runtime_error("import: can't open " + file);
+		delim = file.size() > 4 &&
+			file.compare(file.size() - 4, 4, ".csv") == 0 ? ',' : '\t';
+		if (!next())
+			throw std::runtime_error("import: no header in " + file);
+		header = fields;
+	}
+
+	// номер колонки; необязательная колонка без заголовка - -1
+	int column(const char* name, bool required=true) const
+	{
+		auto itr = std::find(header.begin(), header.end(), name);
+		if (itr != header.end())
+			return itr - header.begin();
+		if (required)
+			throw std::runtime_error("import: no column " + std::string(name) +
+				" in " + file);
+		return -1;
+	}
+
+	bool next()
+	{
+		while (std::getline(in, line)) {
+			++line_no;
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (line.empty())
+				continue;
+			split();
+			return true;
+		}
+		return false;
+	}
+
+	const std::string& operator[](int col) const
+	{
+		static const std::string empty;
+		return col < 0 || (size_t)col >= fields.size() ? empty : fields[col];
+	}
+
+	[[noreturn]] void error(const std::string& what) const
+	{
+		throw std::runtime_error(file + ":" + std::to_string(line_no) +
+			": " + what);
+	}
+
+private:
+	// кавычки - только в CSV, поле целиком в "...", "" внутри - кавычка
+	void split()
+	{
+		size_t n = 0;
+		size_t i = 0;
+		do {
+			if (n == fields.size())
+				fields.emplace_back();
+			auto& f = fields[n++];
+			f.clear();
+			if (delim == ',' && i < line.size() && line[i] == '"') {
+				for (++i; i < line.size(); ++i) {
+					if (line[i] == '"') {
+						if (i + 1 < line.size() && line[i + 1] == '"')
+							++i;
+						else
+							break;
+					}
+					f += line[i];
+				}
+				if (i == line.size())
+					error("unterminated quote");
+				++i;
+			}
+			size_t end = line.find(delim, i);
+			if (end == std::string::npos)
+				end = line.size();
+			f.append(line, i, end - i);
+			i = end + 1;
+		} while (i <= line.size());
+		fields.resize(n);
+	}
+
+	std::string file;
+	std::ifstream in;
+	char buffer[1 << 16];
+	char delim;
+	size_t line_no;
+	std::string line;
+	std::vector<std::string> fields;
+	std::vector<std::string> header;
+};
+
+// ключи строк импорта и таблица снимка, на которую можно сослаться через #id
+class Keys
+{
+public:
+	Keys(const rapidjson::Value& table, const char* what)
+	:table{table}, what{what}
+	{}
+
+	void add(const TableReader& r, const std::string& key, id_t id)
+	{
+		if (key.empty() || key[0] == '#')
+			r.error(std::string("invalid ") + what + " key: " + key);
+		if (!ids.emplace(key, id).second)
+			r.error(std::string("duplicate ") + what + " key: " + key);
+	}
+
+	id_t get(const TableReader& r, const std::string& ref) const
+	{
+		if (!ref.empty() && ref[0] == '#') {
+			if (table.HasMember(ref.c_str() + 1))
+				return std::stoull(ref.substr(1));
+		} else {
+			auto itr = ids.find(ref);
+			if (itr != ids.end())
+				return itr->second;
+		}
+		r.error(std::string("unknown ") + what + ": " + ref);
+	}
+
+private:
+	const rapidjson::Value& table;
+	const char* what;
+	std::unordered_map<std::string, id_t> ids;
+};
+
+static rapidjson::Document read_snapshot(const std::string& file)
+{
+	FILE* fp = std::fopen(file.c_str(), "rb");
+	if (fp == nullptr)
+		throw std::runtime_error("import: can't open " + file);
+
+	static char buffer[1 << 16];
+	rapidjson::FileReadStream is(fp, buffer, sizeof(buffer));
+	rapidjson::Document doc;
+	doc.ParseStream(is);
+	std::fclose(fp);
+	if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("db"))
+		throw std::runtime_error("import: invalid snapshot " + file);
+	return doc;
+}
+
+static const char* tables[] = {"specialties", "clinics", "work_shedule",
+	"doctors"};
+
+// все таблицы заводятся сразу: добавление в db двигает его члены,
+// и ссылки на таблицы, взятые раньше, испортились бы
+static rapidjson::Value& prepare(rapidjson::Document& doc)
+{
+	auto& db = doc["db"];
+	for (const char* name : tables) {
+		if (!db.HasMember(name))
+			db.AddMember(rapidjson::StringRef(name),
+				rapidjson::Value(rapidjson::kObjectType), doc.GetAllocator());
+	}
+	return db;
+}
+
+// id глобальны на все таблицы, новые выдаются после наибольшего
+static id_t max_id(const rapidjson::Value& db)
+{
+	id_t res = 0;
+	for (auto t = db.MemberBegin(); t != db.MemberEnd(); ++t) {
+		if (std::string(t->name.GetString()) == "views" || !t->value.IsObject())
+			continue;
+		for (auto m = t->value.MemberBegin(); m != t->value.MemberEnd(); ++m)
+			res = std::max<id_t>(res, std::stoull(m->name.GetString()));
+	}
+	return res;
+}
+
+static void add_str(rapidjson::Value& obj, const char* key,
+	const std::string& val, Alloc& alloc)
+{
+	obj.AddMember(rapidjson::StringRef(key),
+		rapidjson::Value(val.c_str(), val.size(), alloc), alloc);
+}
+
+static rapidjson::Value foreign_key(id_t from, const std::vector<id_t>& to,
+	Relation rel, OnDelete del, Alloc& alloc)
+{
+	rapidjson::Value obj(rapidjson::kObjectType);
+	rapidjson::Value arr(rapidjson::kArrayType);
+	for (id_t id : to)
+		arr.PushBack((uint64_t)id, alloc);
+	obj.AddMember("from", (uint64_t)from, alloc);
+	obj.AddMember("to", arr, alloc);
+	obj.AddMember("rel", (int)rel, alloc);
+	obj.AddMember("del", (int)del, alloc);
+	return obj;
+}
+
+static void add_row(rapidjson::Value& table, id_t id, rapidjson::Value& obj,
+	Alloc& alloc)
+{
+	std::string key = std::to_string(id);
+	table.AddMember(rapidjson::Value(key.c_str(), key.size(), alloc), obj, alloc);
+}
+
+static int64_t parse_int(const TableReader& r, const std::string& s,
+	const char* what)
+{
+	size_t pos = 0;
+	int64_t res = 0;
+	try {
+		res = std::stoll(s, &pos);
+	} catch (const std::exception&) {
+		pos = 0;
+	}
+	if (pos == 0 || pos != s.size())
+		r.error(std::string("invalid ") + what + ": " + s);
+	return res;
+}
+
+// ЧЧ:ММ в секунды от полуночи
+static time_t parse_time(const TableReader& r, const std::string& s)
+{
+	unsigned h, m;
+	char tail;
+	if (std::sscanf(s.c_str(), "%u:%u%c", &h, &m, &tail) != 2 ||
+			h > 24 || m > 59 || (h == 24 && m))
+		r.error("invalid time: " + s);
+	return h * 3600 + m * 60;
+}
+
+// ГГГГ-ММ-ДД в местную полночь
+static time_t parse_date(const TableReader& r, const std::string& s)
+{
+	int y;
+	unsigned m, d;
+	char tail;
+	if (std::sscanf(s.c_str(), "%d-%u-%u%c", &y, &m, &d, &tail) != 3 ||
+			m < 1 || m > 12 || d < 1 || d > days_in_month(y, m))
+		r.error("invalid date: " + s);
+	return local_mktime(y - 1900, m - 1, d);
+}
+
+struct Importer
+{
+	Importer(rapidjson::Document& doc)
+	:alloc{doc.GetAllocator()}, db{prepare(doc)},
+	specs{db["specialties"], "speciality"},
+	clinics{db["clinics"], "clinic"},
+	schedules{db["work_shedule"], "schedule"},
+	doctors{db["doctors"], "doctor"},
+	next_id{max_id(db) + 1}
+	{}
+
+	size_t import_specialties(const std::string& file)
+	{
+		TableReader r(file);
+		int key = r.column("key"), title = r.column("title"),
+			dur = r.column("dur");
+		auto& t = db["specialties"];
+		size_t n = 0;
+		while (r.next()) {
+			int64_t minutes = parse_int(r, r[dur], "dur");
+			if (minutes <= 0)
+				r.error("dur must be positive");
+
+			id_t id = next_id++;
+			specs.add(r, r[key], id);
+			rapidjson::Value obj(rapidjson::kObjectType);
+			obj.AddMember("id", (uint64_t)id, alloc);
+			add_str(obj, "title", r[title], alloc);
+			obj.AddMember("dur", minutes * 60, alloc);
+			add_row(t, id, obj, alloc);
+			++n;
+		}
+		return n;
+	}
+
+	size_t import_clinics(const std::string& file)
+	{
+		TableReader r(file);
+		int key = r.column("key"), addr = r.column("addr"),
+			lat = r.column("lat", false), lon = r.column("lon", false);
+		auto& t = db["clinics"];
+		size_t n = 0;
+		while (r.next()) {
+			id_t id = next_id++;
+			clinics.add(r, r[key], id);
+			rapidjson::Value obj(rapidjson::kObjectType);
+			obj.AddMember("id", (uint64_t)id, alloc);
+			add_str(obj, "addr", r[addr], alloc);
+			if (!r[lat].empty() || !r[lon].empty()) {
+				try {
+					obj.AddMember("lat", std::stod(r[lat]), alloc);
+					obj.AddMember("lon", std::stod(r[lon]), alloc);
+				} catch (const std::exception&) {
+					r.error("invalid lat/lon");
+				}
+			}
+			add_row(t, id, obj, alloc);
+			++n;
+		}
+		return n;
+	}
+
+	// строки одного расписания могут идти вперемешку с другими
+	size_t import_schedules(const std::string& file)
+	{
+		TableReader r(file);
+		int key = r.column("key"), date = r.column("date"),
+			from = r.column("from"), to = r.column("to");
+
+		std::unordered_map<std::string, size_t> index;
+		std::vector<id_t> ids;
+		std::vector<std::map<time_t, std::vector<std::pair<time_t, time_t>>>> ws;
+		size_t n = 0;
+		while (r.next()) {
+			auto itr = index.find(r[key]);
+			if (itr == index.end()) {
+				id_t id = next_id++;
+				schedules.add(r, r[key], id);
+				itr = index.emplace(r[key], ids.size()).first;
+				ids.push_back(id);
+				ws.emplace_back();
+			}
+
+			time_t f = parse_time(r, r[from]), t = parse_time(r, r[to]);
+			if (f >= t)
+				r.error("empty period: " + r[from] + "-" + r[to]);
+			ws[itr->second][parse_date(r, r[date])].push_back({f, t});
+			++n;
+		}
+
+		auto& t = db["work_shedule"];
+		for (size_t i = 0; i < ids.size(); ++i) {
+			rapidjson::Value days(rapidjson::kObjectType);
+			for (auto& kv : ws[i]) {
+				auto& periods = kv.second;
+				std::sort(periods.begin(), periods.end());
+				rapidjson::Value shift(rapidjson::kArrayType);
+				for (size_t p = 0; p < periods.size(); ++p) {
+					if (p && periods[p].first < periods[p - 1].second)
+						throw std::runtime_error(file + ": overlapping periods"
+							" in schedule #" + std::to_string(ids[i]));
+					rapidjson::Value period(rapidjson::kArrayType);
+					period.PushBack((int64_t)periods[p].first, alloc);
+					period.PushBack((int64_t)periods[p].second, alloc);
+					shift.PushBack(period, alloc);
+				}
+				std::string day = std::to_string(kv.first);
+				days.AddMember(rapidjson::Value(day.c_str(), day.size(), alloc),
+					shift, alloc);
+			}
+			rapidjson::Value obj(rapidjson::kObjectType);
+			obj.AddMember("id", (uint64_t)ids[i], alloc);
+			obj.AddMember("ws", days, alloc);
+			add_row(t, ids[i], obj, alloc);
+		}
+		return n;
+	}
+
+	size_t import_doctors(const std::string& file)
+	{
+		TableReader r(file);
+		int key = r.column("key"), name = r.column("full_name"),
+			phone = r.column("phone_number", false),
+			email = r.column("email", false), photo = r.column("photo", false),
+			desc = r.column("desc", false), spec = r.column("spec"),
+			ws = r.column("ws"), clinic = r.column("clinic");
+		auto& t = db["doctors"];
+		std::vector<id_t> spec_ids;
+		size_t n = 0;
+		while (r.next()) {
+			spec_ids.clear();
+			const auto& refs = r[spec];
+			for (size_t i = 0; i < refs.size();) {
+				size_t end = std::min(refs.find(';', i), refs.size());
+				if (end > i)
+					spec_ids.push_back(specs.get(r, refs.substr(i, end - i)));
+				i = end + 1;
+			}
+			if (spec_ids.empty())
+				r.error("doctor without specialities");
+			id_t ws_id = schedules.get(r, r[ws]);
+			id_t clinic_id = clinics.get(r, r[clinic]);
+
+			id_t id = next_id++;
+			doctors.add(r, r[key], id);
+			rapidjson::Value obj(rapidjson::kObjectType);
+			obj.AddMember("id", (uint64_t)id, alloc);
+			add_str(obj, "full_name", r[name], alloc);
+			add_str(obj, "phone_number", r[phone], alloc);
+			add_str(obj, "email", r[email], alloc);
+			add_str(obj, "photo", r[photo], alloc);
+			add_str(obj, "desc", r[desc], alloc);
+			obj.AddMember("spec", foreign_key(id, spec_ids,
+				Relation::ManyToMany, OnDelete::SetNull, alloc), alloc);
+			obj.AddMember("ws", foreign_key(id, {ws_id},
+				Relation::OneToMany, OnDelete::SetNull, alloc), alloc);
+			obj.AddMember("clinic", foreign_key(id, {clinic_id},
+				Relation::OneToMany, OnDelete::SetNull, alloc), alloc);
+			add_row(t, id, obj, alloc);
+			++n;
+		}
+		return n;
+	}
+
+	Alloc& alloc;
+	rapidjson::Value& db;
+	Keys specs;
+	Keys clinics;
+	Keys schedules;
+	Keys doctors;
+	id_t next_id;
+};
+
+static void write_snapshot(const std::string& file, const rapidjson::Document& doc)
+{
+	FILE* fp = std::fopen(file.c_str(), "wb");
+	if (fp == nullptr)
+		throw std::runtime_error("import: can't open " + file);
+
+	static char buffer[1 << 16];
+	rapidjson::FileWriteStream os(fp, buffer, sizeof(buffer));
+	rapidjson::Writer<rapidjson::FileWriteStream> writer(os);
+	doc.Accept(writer);
+	os.Flush();
+	if (std::fclose(fp) != 0)
+		throw std::runtime_error("import: can't write " + file);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3 || argc % 2 == 0) {
+		std::cerr << "usage: " << argv[0] << " <db.json> <out.json>"
+			" [--specialties file] [--clinics file]"
+			" [--schedules file] [--doctors file]\n";
+		return 1;
+	}
+
+	std::unordered_map<std::string, std::string> files;
+	for (int i = 3; i < argc; i += 2)
+		files[argv[i]] = argv[i + 1];
+
+	try {
+		auto start = std::chrono::steady_clock::now();
+		auto doc = read_snapshot(argv[1]);
+		Importer imp(doc);
+
+		// порядок важен: врачи ссылаются на всё остальное
+		using import_f = size_t (Importer::*)(const std::string&);
+		const std::pair<std::string, import_f> kinds[] = {
+			{"specialties", &Importer::import_specialties},
+			{"clinics", &Importer::import_clinics},
+			{"schedules", &Importer::import_schedules},
+			{"doctors", &Importer::import_doctors}};
+
+		size_t rows = 0;
+		for (const auto& kind : kinds) {
+			auto itr = files.find("--" + kind.first);
+			if (itr == files.end())
+				continue;
+
+			size_t n = (imp.*kind.second)(itr->second);
+			std::cout << kind.first << ": " << n << "\n";
+			rows += n;
+			files.erase(itr);
+		}
+		if (!files.empty())
+			throw std::runtime_error("import: unknown option " +
+				files.begin()->first);
+
+		write_snapshot(argv[2], doc);
+		std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+		std::cout << rows << " rows in " << dt.count() << " s\n";
+	} catch (const std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}